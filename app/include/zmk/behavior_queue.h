@@ -7,8 +7,36 @@
 #pragma once
 
 #include <zephyr/kernel.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <zmk/behavior.h>
 
+// Queued behaviors run in lanes. Each lane invokes its steps in order, waiting between them as
+// requested. Lanes added for the same key position run one after another, while lanes for
+// different key positions run independently of each other.
+
+struct zmk_behavior_queue_step {
+    struct zmk_behavior_binding binding;
+    bool press;
+    // Time to wait in milliseconds before the next step of the lane.
+    uint32_t wait;
+};
+
+// Produces the next step of a lane from the context it was added with. Returns false once the lane
+// has no steps left.
+typedef bool (*zmk_behavior_queue_next_t)(void *context, struct zmk_behavior_queue_step *step);
+
+#define ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE 56
+
+// Adds a lane whose steps are produced one at a time by `next`, which lets long sequences such as
+// macros step through their bindings in place. The context is copied into the lane.
+int zmk_behavior_queue_add_lane(uint32_t position, zmk_behavior_queue_next_t next,
+                                const void *context, size_t context_size);
+
 int zmk_behavior_queue_add(uint32_t position, const struct zmk_behavior_binding behavior,
                            bool press, uint32_t wait);
+
+// Queues `count` taps of the binding, each held for `tap_ms`. Taps of the same binding queued for
+// a position in a row share one lane, so bursts such as fast encoder turns do not run out of lanes.
+int zmk_behavior_queue_add_taps(uint32_t position, const struct zmk_behavior_binding binding,
+                                uint32_t tap_ms, uint32_t count);
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <zephyr/bluetooth/conn.h>
+
 #include <zmk/keys.h>
 #include <zmk/ble/profile.h>
 
@@ -26,9 +28,14 @@ int zmk_ble_prof_prev();
 int zmk_ble_prof_select(uint8_t index);
 
 int zmk_ble_active_profile_index();
+// Returns the index of the profile paired with the address, or -ENODEV if there is none.
+int zmk_ble_profile_index(const bt_addr_le_t *addr);
 bt_addr_le_t *zmk_ble_active_profile_addr();
 bool zmk_ble_active_profile_is_open();
 bool zmk_ble_active_profile_is_connected();
+// Returns a new reference to the connection to the active profile's host, or NULL if it isn't
+// connected. Release it with bt_conn_unref().
+struct bt_conn *zmk_ble_active_profile_conn();
 char *zmk_ble_active_profile_name();
 
 int zmk_ble_unpair_all();
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr/bluetooth/conn.h>
+
+// Connection parameters requested from and accepted by the host of a profile, to see how hosts
+// respond to the requests.
+struct zmk_ble_conn_params_stats {
+    // Parameters requested last. Intervals are in units of 1.25 ms.
+    struct bt_le_conn_param requested;
+    // Parameters the connection uses now.
+    uint16_t interval;
+    uint16_t latency;
+    uint16_t timeout;
+    uint32_t requests;
+    // Updates that matched, or didn't match, the parameters requested last.
+    uint32_t accepted;
+    uint32_t rejected;
+};
+
+const struct zmk_ble_conn_params_stats *zmk_ble_conn_params_get_stats(uint8_t profile);
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr/sys/util.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zmk/behavior.h>
+#include <zmk/keymap.h>
+#include <zmk/matrix.h>
+
+/*
+ * combo.c captures key events, activates and releases combos and handles their timeouts. Which
+ * combos are still candidates for the captured keys is tracked by one of two engines:
+ * combo_lookup.c keeps sorted lists of the combos on each key position, and combo_chord.c, enabled
+ * by CONFIG_ZMK_COMBO_CHORD_TABLE, uses bitmaps and a hash table keyed by the pressed positions.
+ */
+
+#if IS_ENABLED(CONFIG_ZMK_COMBO_CHORD_TABLE)
+// Chords aren't limited in length, so every key may end up captured.
+#define ZMK_COMBO_PRESSED_KEYS_MAX ZMK_KEYMAP_LEN
+#else
+#define ZMK_COMBO_PRESSED_KEYS_MAX CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO
+#endif
+
+struct combo_cfg {
+    const int32_t *key_positions;
+    int32_t key_position_len;
+    struct zmk_behavior_binding behavior;
+    int32_t timeout_ms;
+    int32_t require_prior_idle_ms;
+    // if slow release is set, the combo releases when the last key is released.
+    // otherwise, the combo releases when the first key is released.
+    bool slow_release;
+    // the virtual key position is a key position outside the range used by the keyboard.
+    // it is necessary so hold-taps can uniquely identify a behavior.
+    int32_t virtual_key_position;
+    // the layers on which this combo can trigger
+    zmk_keymap_layers_state_t layer_mask;
+};
+
+struct zmk_combo_position_mask {
+    uint32_t words[DIV_ROUND_UP(ZMK_KEYMAP_LEN, 32)];
+};
+
+static inline void zmk_combo_position_mask_set(struct zmk_combo_position_mask *mask,
+                                               int32_t position) {
+    mask->words[position / 32] |= BIT(position % 32);
+}
+
+static inline void zmk_combo_position_mask_clear(struct zmk_combo_position_mask *mask,
+                                                 int32_t position) {
+    mask->words[position / 32] &= ~BIT(position % 32);
+}
+
+static inline bool zmk_combo_position_mask_test(const struct zmk_combo_position_mask *mask,
+                                                int32_t position) {
+    return (mask->words[position / 32] & BIT(position % 32)) != 0;
+}
+
+static inline bool zmk_combo_position_mask_is_empty(const struct zmk_combo_position_mask *mask) {
+    for (int i = 0; i < ARRAY_SIZE(mask->words); i++) {
+        if (mask->words[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool zmk_combo_position_mask_equals(const struct zmk_combo_position_mask *a,
+                                                  const struct zmk_combo_position_mask *b) {
+    return memcmp(a, b, sizeof(struct zmk_combo_position_mask)) == 0;
+}
+
+// Whether the combo is kept from triggering because a key was tapped less than its
+// require-prior-idle-ms ago. Implemented by combo.c.
+bool zmk_combo_is_quick_tap(const struct combo_cfg *combo, int64_t timestamp);
+
+// Indexes the combos, which are in devicetree order.
+int zmk_combo_candidates_init(const struct combo_cfg *combos, int count);
+
+// Limits new candidates to the combos that can trigger on the layer.
+void zmk_combo_candidates_set_layer(uint8_t layer);
+
+// Sets up the candidates for the first captured key, leaving out quick taps. Returns their number.
+int zmk_combo_candidates_setup(int32_t position, int64_t timestamp);
+
+// Keeps the candidates that use the position. Returns their number.
+int zmk_combo_candidates_filter(int32_t position);
+
+// Drops the candidates that timed out at the timestamp. Returns the number left.
+int zmk_combo_candidates_filter_timed_out(int64_t timestamp);
+
+// Returns the earliest timeout of the candidates, or LLONG_MAX if there are none.
+int64_t zmk_combo_candidates_first_timeout(void);
+
+bool zmk_combo_candidates_is_empty(void);
+
+void zmk_combo_candidates_clear(void);
+
+// Returns the candidate made up of exactly the captured keys, or NULL. pressed_count is the number
+// of captured keys before the first free slot, and pressed holds the positions of all of them.
+const struct combo_cfg *
+zmk_combo_candidates_completely_pressed(const struct zmk_combo_position_mask *pressed,
+                                        int pressed_count);
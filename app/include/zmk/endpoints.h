@@ -69,4 +69,11 @@ int zmk_endpoints_toggle_transport(void);
 struct zmk_endpoint_instance zmk_endpoints_selected(void);
 
 int zmk_endpoints_send_report(uint16_t usage_page);
+
+/**
+ * Whether the selected endpoint can take another keyboard report right away, without blocking or
+ * dropping reports that are still waiting to be sent.
+ */
+bool zmk_endpoints_keyboard_report_ready(void);
+
 int zmk_endpoints_send_mouse_report();
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/addr.h>
+#include <zmk/event_manager.h>
+
+// Raised whenever the PHY or data length of a connection, to a host or to another split half,
+// changes.
+struct zmk_ble_link_updated {
+    bt_addr_le_t addr;
+    // BT_GAP_LE_PHY_* values.
+    uint8_t tx_phy;
+    uint8_t rx_phy;
+    // Max payload of a link layer data packet in bytes.
+    uint16_t tx_max_len;
+    uint16_t rx_max_len;
+};
+
+ZMK_EVENT_DECLARE(zmk_ble_link_updated);
\ No newline at end of file
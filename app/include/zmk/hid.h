@@ -16,164 +16,163 @@
 
 #define ZMK_HID_KEYBOARD_NKRO_MAX_USAGE HID_USAGE_KEY_KEYPAD_EQUAL
 
+#define ZMK_HID_KEYBOARD_USAGE_MASK_WORDS DIV_ROUND_UP(ZMK_HID_KEYBOARD_NKRO_MAX_USAGE + 1, 32)
+
 #define COLLECTION_REPORT 0x03
 
-static const uint8_t zmk_hid_report_desc[] = {
-    HID_USAGE_PAGE(HID_USAGE_GEN_DESKTOP),
-    HID_USAGE(HID_USAGE_GD_KEYBOARD),
-    HID_COLLECTION(HID_COLLECTION_APPLICATION),
-    HID_REPORT_ID(0x01),
-    HID_USAGE_PAGE(HID_USAGE_KEY),
-    HID_USAGE_MIN8(HID_USAGE_KEY_KEYBOARD_LEFTCONTROL),
-    HID_USAGE_MAX8(HID_USAGE_KEY_KEYBOARD_RIGHT_GUI),
-    HID_LOGICAL_MIN8(0x00),
-    HID_LOGICAL_MAX8(0x01),
-
-    HID_REPORT_SIZE(0x01),
-    HID_REPORT_COUNT(0x08),
-    /* INPUT (Data,Var,Abs) */
-    HID_INPUT(0x02),
-
-    HID_USAGE_PAGE(HID_USAGE_KEY),
-    HID_REPORT_SIZE(0x08),
-    HID_REPORT_COUNT(0x01),
-    /* INPUT (Cnst,Var,Abs) */
-    HID_INPUT(0x03),
-
-    HID_USAGE_PAGE(HID_USAGE_KEY),
+#define ZMK_HID_REPORT_ID_KEYBOARD 0x01
+#define ZMK_HID_REPORT_ID_CONSUMER 0x02
+#define ZMK_HID_REPORT_ID_MOUSE 0x04
 
 #if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_NKRO)
-    HID_LOGICAL_MIN8(0x00),
-    HID_LOGICAL_MAX8(0x01),
-    HID_USAGE_MIN8(0x00),
-    HID_USAGE_MAX8(ZMK_HID_KEYBOARD_NKRO_MAX_USAGE),
-    HID_REPORT_SIZE(0x01),
-    HID_REPORT_COUNT(ZMK_HID_KEYBOARD_NKRO_MAX_USAGE + 1),
-    /* INPUT (Data,Ary,Abs) */
-    HID_INPUT(0x02),
+#define ZMK_HID_KEYBOARD_KEYS_DESC                                                                 \
+    HID_LOGICAL_MIN8(0x00), HID_LOGICAL_MAX8(0x01), HID_USAGE_MIN8(0x00),                          \
+        HID_USAGE_MAX8(ZMK_HID_KEYBOARD_NKRO_MAX_USAGE), HID_REPORT_SIZE(0x01),                    \
+        HID_REPORT_COUNT(ZMK_HID_KEYBOARD_NKRO_MAX_USAGE + 1),                                     \
+        /* INPUT (Data,Ary,Abs) */                                                                 \
+        HID_INPUT(0x02)
 #elif IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
-    HID_LOGICAL_MIN8(0x00),
-    HID_LOGICAL_MAX16(0xFF, 0x00),
-    HID_USAGE_MIN8(0x00),
-    HID_USAGE_MAX8(0xFF),
-    HID_REPORT_SIZE(0x08),
-    HID_REPORT_COUNT(CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE),
-    /* INPUT (Data,Ary,Abs) */
-    HID_INPUT(0x00),
+#define ZMK_HID_KEYBOARD_KEYS_DESC                                                                 \
+    HID_LOGICAL_MIN8(0x00), HID_LOGICAL_MAX16(0xFF, 0x00), HID_USAGE_MIN8(0x00),                   \
+        HID_USAGE_MAX8(0xFF), HID_REPORT_SIZE(0x08),                                               \
+        HID_REPORT_COUNT(CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE),                                     \
+        /* INPUT (Data,Ary,Abs) */                                                                 \
+        HID_INPUT(0x00)
 #else
 #error "A proper HID report type must be selected"
 #endif
 
-    HID_END_COLLECTION,
-    HID_USAGE_PAGE(HID_USAGE_CONSUMER),
-    HID_USAGE(HID_USAGE_CONSUMER_CONSUMER_CONTROL),
-    HID_COLLECTION(HID_COLLECTION_APPLICATION),
-    HID_REPORT_ID(0x02),
-    HID_USAGE_PAGE(HID_USAGE_CONSUMER),
-
 #if IS_ENABLED(CONFIG_ZMK_HID_CONSUMER_REPORT_USAGES_BASIC)
-    HID_LOGICAL_MIN8(0x00),
-    HID_LOGICAL_MAX16(0xFF, 0x00),
-    HID_USAGE_MIN8(0x00),
-    HID_USAGE_MAX8(0xFF),
-    HID_REPORT_SIZE(0x08),
+#define ZMK_HID_CONSUMER_USAGES_DESC                                                               \
+    HID_LOGICAL_MIN8(0x00), HID_LOGICAL_MAX16(0xFF, 0x00), HID_USAGE_MIN8(0x00),                   \
+        HID_USAGE_MAX8(0xFF), HID_REPORT_SIZE(0x08)
 #elif IS_ENABLED(CONFIG_ZMK_HID_CONSUMER_REPORT_USAGES_FULL)
-    HID_LOGICAL_MIN8(0x00),
-    HID_LOGICAL_MAX16(0xFF, 0x0F),
-    HID_USAGE_MIN8(0x00),
-    HID_USAGE_MAX16(0xFF, 0x0F),
-    HID_REPORT_SIZE(0x10),
+#define ZMK_HID_CONSUMER_USAGES_DESC                                                               \
+    HID_LOGICAL_MIN8(0x00), HID_LOGICAL_MAX16(0xFF, 0x0F), HID_USAGE_MIN8(0x00),                   \
+        HID_USAGE_MAX16(0xFF, 0x0F), HID_REPORT_SIZE(0x10)
 #else
 #error "A proper consumer HID report usage range must be selected"
 #endif
-    /* REPORT_COUNT (CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE) */
-    HID_REPORT_COUNT(CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE),
-    HID_INPUT(0x00),
-    /* END COLLECTION */
-    HID_END_COLLECTION,
-
-    /* USAGE_PAGE (Generic Desktop) */
-    HID_USAGE_PAGE(HID_USAGE_GD),
-    /* USAGE (Mouse) */
-    HID_USAGE(HID_USAGE_GD_MOUSE),
-    /* COLLECTION (Application) */
-    HID_COLLECTION(HID_COLLECTION_APPLICATION),
-    /* REPORT ID (4) */
-    HID_REPORT_ID(0x04),
-    /* USAGE (Pointer) */
-    HID_USAGE(HID_USAGE_GD_POINTER),
-    /* COLLECTION (Physical) */
-    HID_COLLECTION(HID_COLLECTION_PHYSICAL),
-    /* USAGE_PAGE (Button) */
-    HID_USAGE_PAGE(HID_USAGE_BUTTON),
-    /* USAGE_MINIMUM (0x1) (button 1?) */
-    HID_USAGE_MIN8(0x01),
-    /* USAGE_MAXIMUM (0x10) (button 5? Buttons up to 8 still work) */
-    HID_USAGE_MAX8(0x10),
-    /* LOGICAL_MINIMUM (0) */
-    HID_LOGICAL_MIN8(0x00),
-    /* LOGICAL_MAXIMUM (1) */
-    HID_LOGICAL_MAX8(0x01),
-    /* REPORT_SIZE (1) */
-    HID_REPORT_SIZE(0x01),
-    /* REPORT_COUNT (16) */
-    HID_REPORT_COUNT(0x10),
-    /* INPUT (Data,Var,Abs) */
-    HID_INPUT(0x02),
-    /* USAGE_PAGE (Generic Desktop) */
-    HID_USAGE_PAGE(HID_USAGE_GD),
-    /* LOGICAL_MINIMUM (-32767) */
-    HID_LOGICAL_MIN16(0x01, 0x80),
-    /* LOGICAL_MAXIMUM (32767) */
-    HID_LOGICAL_MAX16(0xFF, 0x7F),
-    /* REPORT_SIZE (16) */
-    HID_REPORT_SIZE(0x10),
-    /* REPORT_COUNT (2) */
-    HID_REPORT_COUNT(0x02),
-    /* USAGE (X) */ // Vertical scroll
-    HID_USAGE(HID_USAGE_GD_X),
-    /* USAGE (Y) */
-    HID_USAGE(HID_USAGE_GD_Y),
-    /* Input (Data,Var,Rel) */
-    HID_INPUT(0x06),
-    /* LOGICAL_MINIMUM (-127) */
-    HID_LOGICAL_MIN8(0x81),
-    /* LOGICAL_MAXIMUM (127) */
-    HID_LOGICAL_MAX8(0x7F),
-    /* REPORT_SIZE (8) */
-    HID_REPORT_SIZE(0x08),
-    /* REPORT_COUNT (1) */
-    HID_REPORT_COUNT(0x01),
-    /* USAGE (Wheel) */
-    HID_USAGE(HID_USAGE_GD_WHEEL),
-    /* Input (Data,Var,Rel) */
-    HID_INPUT(0x06),
-    /* USAGE_PAGE (Consumer) */ // Horizontal scroll
-    HID_USAGE_PAGE(HID_USAGE_CONSUMER),
-    /* USAGE (AC Pan) */
-    0x0A,
-    0x38,
-    0x02,
-    /* LOGICAL_MINIMUM (-127) */
-    HID_LOGICAL_MIN8(0x81),
-    /* LOGICAL_MAXIMUM (127) */
-    HID_LOGICAL_MAX8(0x7F),
-    /* REPORT_COUNT (1) */
-    HID_REPORT_COUNT(0x01),
-    /* Input (Data,Var,Rel) */
-    HID_INPUT(0x06),
-    /* END COLLECTION */
-    HID_END_COLLECTION,
-    /* END COLLECTION */
-    HID_END_COLLECTION,
+
+// The report descriptor is made up of one top level collection per report, so the collections can
+// also be exposed on separate USB HID interfaces.
+
+#define ZMK_HID_KEYBOARD_REPORT_DESC                                                               \
+    HID_USAGE_PAGE(HID_USAGE_GEN_DESKTOP), HID_USAGE(HID_USAGE_GD_KEYBOARD),                       \
+        HID_COLLECTION(HID_COLLECTION_APPLICATION), HID_REPORT_ID(ZMK_HID_REPORT_ID_KEYBOARD),     \
+        HID_USAGE_PAGE(HID_USAGE_KEY), HID_USAGE_MIN8(HID_USAGE_KEY_KEYBOARD_LEFTCONTROL),         \
+        HID_USAGE_MAX8(HID_USAGE_KEY_KEYBOARD_RIGHT_GUI), HID_LOGICAL_MIN8(0x00),                  \
+        HID_LOGICAL_MAX8(0x01),                                                                    \
+                                                                                                   \
+        HID_REPORT_SIZE(0x01), HID_REPORT_COUNT(0x08),                                             \
+        /* INPUT (Data,Var,Abs) */                                                                 \
+        HID_INPUT(0x02),                                                                           \
+                                                                                                   \
+        HID_USAGE_PAGE(HID_USAGE_KEY), HID_REPORT_SIZE(0x08), HID_REPORT_COUNT(0x01),              \
+        /* INPUT (Cnst,Var,Abs) */                                                                 \
+        HID_INPUT(0x03),                                                                           \
+                                                                                                   \
+        HID_USAGE_PAGE(HID_USAGE_KEY), ZMK_HID_KEYBOARD_KEYS_DESC,                                 \
+                                                                                                   \
+        HID_END_COLLECTION
+
+#define ZMK_HID_CONSUMER_REPORT_DESC                                                               \
+    HID_USAGE_PAGE(HID_USAGE_CONSUMER), HID_USAGE(HID_USAGE_CONSUMER_CONSUMER_CONTROL),            \
+        HID_COLLECTION(HID_COLLECTION_APPLICATION), HID_REPORT_ID(ZMK_HID_REPORT_ID_CONSUMER),     \
+        HID_USAGE_PAGE(HID_USAGE_CONSUMER), ZMK_HID_CONSUMER_USAGES_DESC,                          \
+        /* REPORT_COUNT (CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE) */                                   \
+        HID_REPORT_COUNT(CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE), HID_INPUT(0x00),                    \
+        /* END COLLECTION */                                                                       \
+        HID_END_COLLECTION
+
+#define ZMK_HID_MOUSE_REPORT_DESC                                                                  \
+    /* USAGE_PAGE (Generic Desktop) */                                                             \
+    HID_USAGE_PAGE(HID_USAGE_GD),                                                                  \
+        /* USAGE (Mouse) */                                                                        \
+        HID_USAGE(HID_USAGE_GD_MOUSE),                                                             \
+        /* COLLECTION (Application) */                                                             \
+        HID_COLLECTION(HID_COLLECTION_APPLICATION),                                                \
+        /* REPORT ID (4) */                                                                        \
+        HID_REPORT_ID(ZMK_HID_REPORT_ID_MOUSE),                                                    \
+        /* USAGE (Pointer) */                                                                      \
+        HID_USAGE(HID_USAGE_GD_POINTER),                                                           \
+        /* COLLECTION (Physical) */                                                                \
+        HID_COLLECTION(HID_COLLECTION_PHYSICAL),                                                   \
+        /* USAGE_PAGE (Button) */                                                                  \
+        HID_USAGE_PAGE(HID_USAGE_BUTTON),                                                          \
+        /* USAGE_MINIMUM (0x1) (button 1?) */                                                      \
+        HID_USAGE_MIN8(0x01),                                                                      \
+        /* USAGE_MAXIMUM (0x10) (button 5? Buttons up to 8 still work) */                          \
+        HID_USAGE_MAX8(0x10),                                                                      \
+        /* LOGICAL_MINIMUM (0) */                                                                  \
+        HID_LOGICAL_MIN8(0x00),                                                                    \
+        /* LOGICAL_MAXIMUM (1) */                                                                  \
+        HID_LOGICAL_MAX8(0x01),                                                                    \
+        /* REPORT_SIZE (1) */                                                                      \
+        HID_REPORT_SIZE(0x01),                                                                     \
+        /* REPORT_COUNT (16) */                                                                    \
+        HID_REPORT_COUNT(0x10),                                                                    \
+        /* INPUT (Data,Var,Abs) */                                                                 \
+        HID_INPUT(0x02),                                                                           \
+        /* USAGE_PAGE (Generic Desktop) */                                                         \
+        HID_USAGE_PAGE(HID_USAGE_GD),                                                              \
+        /* LOGICAL_MINIMUM (-32767) */                                                             \
+        HID_LOGICAL_MIN16(0x01, 0x80),                                                             \
+        /* LOGICAL_MAXIMUM (32767) */                                                              \
+        HID_LOGICAL_MAX16(0xFF, 0x7F),                                                             \
+        /* REPORT_SIZE (16) */                                                                     \
+        HID_REPORT_SIZE(0x10),                                                                     \
+        /* REPORT_COUNT (2) */                                                                     \
+        HID_REPORT_COUNT(0x02),                                                                    \
+        /* USAGE (X) */ /* Vertical scroll */                                                      \
+        HID_USAGE(HID_USAGE_GD_X),                                                                 \
+        /* USAGE (Y) */                                                                            \
+        HID_USAGE(HID_USAGE_GD_Y),                                                                 \
+        /* Input (Data,Var,Rel) */                                                                 \
+        HID_INPUT(0x06),                                                                           \
+        /* LOGICAL_MINIMUM (-127) */                                                               \
+        HID_LOGICAL_MIN8(0x81),                                                                    \
+        /* LOGICAL_MAXIMUM (127) */                                                                \
+        HID_LOGICAL_MAX8(0x7F),                                                                    \
+        /* REPORT_SIZE (8) */                                                                      \
+        HID_REPORT_SIZE(0x08),                                                                     \
+        /* REPORT_COUNT (1) */                                                                     \
+        HID_REPORT_COUNT(0x01),                                                                    \
+        /* USAGE (Wheel) */                                                                        \
+        HID_USAGE(HID_USAGE_GD_WHEEL),                                                             \
+        /* Input (Data,Var,Rel) */                                                                 \
+        HID_INPUT(0x06),                                                                           \
+        /* USAGE_PAGE (Consumer) */ /* Horizontal scroll */                                        \
+        HID_USAGE_PAGE(HID_USAGE_CONSUMER),                                                        \
+        /* USAGE (AC Pan) */                                                                       \
+        0x0A, 0x38, 0x02,                                                                          \
+        /* LOGICAL_MINIMUM (-127) */                                                               \
+        HID_LOGICAL_MIN8(0x81),                                                                    \
+        /* LOGICAL_MAXIMUM (127) */                                                                \
+        HID_LOGICAL_MAX8(0x7F),                                                                    \
+        /* REPORT_COUNT (1) */                                                                     \
+        HID_REPORT_COUNT(0x01),                                                                    \
+        /* Input (Data,Var,Rel) */                                                                 \
+        HID_INPUT(0x06),                                                                           \
+        /* END COLLECTION */                                                                       \
+        HID_END_COLLECTION,                                                                        \
+        /* END COLLECTION */                                                                       \
+        HID_END_COLLECTION
+
+static const uint8_t zmk_hid_report_desc[] = {
+    ZMK_HID_KEYBOARD_REPORT_DESC,
+    ZMK_HID_CONSUMER_REPORT_DESC,
+    ZMK_HID_MOUSE_REPORT_DESC,
 };
 
-// struct zmk_hid_boot_report
-// {
-//     uint8_t modifiers;
-//     uint8_t _unused;
-//     uint8_t keys[6];
-// } __packed;
+#define ZMK_HID_BOOT_KEY_LEN 6
+
+// Keyboard report in the fixed boot protocol format, which has no report ID.
+struct zmk_hid_boot_report {
+    zmk_mod_flags_t modifiers;
+    uint8_t _reserved;
+    uint8_t keys[ZMK_HID_BOOT_KEY_LEN];
+} __packed;
 
 struct zmk_hid_keyboard_report_body {
     zmk_mod_flags_t modifiers;
@@ -190,6 +189,19 @@ struct zmk_hid_keyboard_report {
     struct zmk_hid_keyboard_report_body body;
 } __packed;
 
+// Set of keyboard page usages up to ZMK_HID_KEYBOARD_NKRO_MAX_USAGE, for pressing or releasing
+// several keys at once. Modifiers are not part of it, use zmk_hid_register_mods() for those.
+struct zmk_hid_keyboard_usage_mask {
+    uint32_t words[ZMK_HID_KEYBOARD_USAGE_MASK_WORDS];
+};
+
+static inline void zmk_hid_keyboard_usage_mask_add(struct zmk_hid_keyboard_usage_mask *mask,
+                                                   zmk_key_t usage) {
+    if (usage <= ZMK_HID_KEYBOARD_NKRO_MAX_USAGE) {
+        mask->words[usage / 32] |= BIT(usage % 32);
+    }
+}
+
 struct zmk_hid_consumer_report_body {
 #if IS_ENABLED(CONFIG_ZMK_HID_CONSUMER_REPORT_USAGES_BASIC)
     uint8_t keys[CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE];
@@ -223,8 +235,10 @@ bool zmk_hid_mod_is_pressed(zmk_mod_t modifier);
 
 int zmk_hid_register_mods(zmk_mod_flags_t explicit_modifiers);
 int zmk_hid_unregister_mods(zmk_mod_flags_t explicit_modifiers);
-int zmk_hid_implicit_modifiers_press(zmk_mod_flags_t implicit_modifiers);
-int zmk_hid_implicit_modifiers_release();
+// Implicit modifiers are tracked per usage. They apply until the last usage pressed with them is
+// released, or until a usage with different implicit modifiers is pressed.
+int zmk_hid_implicit_modifiers_press(uint32_t usage, zmk_mod_flags_t implicit_modifiers);
+int zmk_hid_implicit_modifiers_release(uint32_t usage);
 int zmk_hid_masked_modifiers_set(zmk_mod_flags_t masked_modifiers);
 int zmk_hid_masked_modifiers_clear();
 
@@ -233,6 +247,11 @@ int zmk_hid_keyboard_release(zmk_key_t key);
 void zmk_hid_keyboard_clear();
 bool zmk_hid_keyboard_is_pressed(zmk_key_t key);
 
+// Press or release every usage in the mask, so callers can apply a batch of changes and send a
+// single report. Return 1 if the report changed and 0 if it didn't.
+int zmk_hid_keyboard_press_mask(const struct zmk_hid_keyboard_usage_mask *mask);
+int zmk_hid_keyboard_release_mask(const struct zmk_hid_keyboard_usage_mask *mask);
+
 int zmk_hid_consumer_press(zmk_key_t key);
 int zmk_hid_consumer_release(zmk_key_t key);
 void zmk_hid_consumer_clear();
@@ -253,5 +272,9 @@ void zmk_hid_mouse_scroll_update(int8_t x, int8_t y);
 void zmk_hid_mouse_clear();
 
 struct zmk_hid_keyboard_report *zmk_hid_get_keyboard_report();
+// Fills in the boot protocol equivalent of a keyboard report. If more keys are pressed than fit
+// into it, every key slot is set to ErrorRollOver while the modifiers are still reported.
+void zmk_hid_keyboard_report_to_boot(const struct zmk_hid_keyboard_report *report,
+                                     struct zmk_hid_boot_report *boot);
 struct zmk_hid_consumer_report *zmk_hid_get_consumer_report();
 struct zmk_hid_mouse_report *zmk_hid_get_mouse_report();
@@ -8,10 +8,16 @@
 
 #include <zmk/keys.h>
 #include <zmk/hid.h>
+#include <zmk/hog_report_queue.h>
 
 int zmk_hog_init();
 
 int zmk_hog_send_keyboard_report(struct zmk_hid_keyboard_report_body *body);
+// Whether the keyboard report queue has room, so sending another report won't drop a queued one.
+bool zmk_hog_keyboard_report_queue_has_space(void);
+void zmk_hog_get_keyboard_queue_stats(struct zmk_hog_queue_stats *stats);
 int zmk_hog_send_consumer_report(struct zmk_hid_consumer_report_body *body);
+bool zmk_hog_consumer_report_queue_has_space(void);
+void zmk_hog_get_consumer_queue_stats(struct zmk_hog_queue_stats *stats);
 int zmk_hog_send_mouse_report(struct zmk_hid_mouse_report_body *body);
 int zmk_hog_send_mouse_report_direct(struct zmk_hid_mouse_report_body *body);
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct zmk_hog_queue_stats {
+    // Reports combined with the next one without hiding a change from the host.
+    uint32_t merged;
+    // Reports overwritten while the queue was full, whose changes the host never saw.
+    uint32_t dropped;
+};
+
+// Where the usages of a report are. Reports hold an array of usages from array_offset on, such as
+// the keys of an HKRO keyboard report, whose elements are compared as a set. Bytes before it are
+// compared bit by bit. Reports without an array of usages use their size as the array offset.
+struct zmk_hog_report_layout {
+    size_t size;
+    size_t array_offset;
+    uint8_t array_elem_size;
+};
+
+// Whether a report can be left out between the one before and the one after it, because no change
+// it makes is undone by the next one, so the host still sees every transition.
+bool zmk_hog_report_can_merge(const struct zmk_hog_report_layout *layout, const uint8_t *prev,
+                              const uint8_t *report, const uint8_t *next);
+
+// Queue of reports of one type waiting to be notified. Putting a report never blocks: when the
+// queue is full, a queued report is merged away instead, picking one whose state the host doesn't
+// have to see, so no key press or release is lost to backpressure.
+struct zmk_hog_report_queue {
+    uint8_t *reports;
+    // The report taken from the queue last, which queued reports are compared against.
+    uint8_t *last_taken;
+    struct zmk_hog_report_layout layout;
+    uint8_t capacity;
+    uint8_t head;
+    uint8_t count;
+    struct zmk_hog_queue_stats stats;
+    struct k_spinlock lock;
+};
+
+#define ZMK_HOG_REPORT_QUEUE_DEFINE(name, type, _capacity, _array_offset, _array_elem_size)        \
+    static uint8_t name##_reports[_capacity][sizeof(type)];                                        \
+    static uint8_t name##_last_taken[sizeof(type)];                                                \
+    static struct zmk_hog_report_queue name = {                                                    \
+        .reports = &name##_reports[0][0],                                                          \
+        .last_taken = name##_last_taken,                                                           \
+        .layout = {.size = sizeof(type),                                                           \
+                   .array_offset = _array_offset,                                                  \
+                   .array_elem_size = _array_elem_size},                                           \
+        .capacity = _capacity,                                                                     \
+    }
+
+void zmk_hog_report_queue_put(struct zmk_hog_report_queue *queue, const void *report);
+bool zmk_hog_report_queue_get(struct zmk_hog_report_queue *queue, void *report);
+// Drops the queued reports. The next host starts out with nothing pressed.
+void zmk_hog_report_queue_purge(struct zmk_hog_report_queue *queue);
+bool zmk_hog_report_queue_has_space(struct zmk_hog_report_queue *queue);
+void zmk_hog_report_queue_get_stats(struct zmk_hog_report_queue *queue,
+                                    struct zmk_hog_queue_stats *stats);
@@ -6,11 +6,18 @@
 
 #pragma once
 
+#include <zephyr/sys/util.h>
 #include <zmk/events/sensor_event.h>
+#include <zmk/matrix.h>
 #include <zmk/sensors.h>
 
 #define ZMK_SPLIT_RUN_BEHAVIOR_DEV_LEN 9
 
+// Bytes of the bitmap holding the state of every key position. Both halves share the keymap, so
+// the length in a position state payload also tells the central how many positions the peripheral
+// has.
+#define ZMK_SPLIT_POS_STATE_LEN DIV_ROUND_UP(ZMK_KEYMAP_LEN, 8)
+
 struct sensor_event {
     uint8_t sensor_index;
 
@@ -18,6 +25,22 @@ struct sensor_event {
     struct zmk_sensor_channel_data channel_data[ZMK_SENSOR_EVENT_MAX_CHANNELS];
 } __packed;
 
+// Value of the position state characteristic when read. Notifications of it only carry the state.
+struct zmk_split_position_state {
+    // Sequence number of the last position event reflected in the state.
+    uint16_t seq;
+    uint8_t state[ZMK_SPLIT_POS_STATE_LEN];
+} __packed;
+
+// Notifications of the position events characteristic carry one or more of these, in order.
+struct zmk_split_position_event {
+    uint16_t seq;
+    uint8_t position;
+    uint8_t state;
+    // Uptime of the peripheral in milliseconds when the position changed.
+    uint32_t timestamp;
+} __packed;
+
 struct zmk_split_run_behavior_data {
     uint8_t position;
     uint8_t state;
@@ -30,8 +53,20 @@ struct zmk_split_run_behavior_payload {
     char behavior_dev[ZMK_SPLIT_RUN_BEHAVIOR_DEV_LEN];
 } __packed;
 
-int zmk_split_bt_position_pressed(uint8_t position);
-int zmk_split_bt_position_released(uint8_t position);
+// The central assigns IDs to behavior labels for each connection to a peripheral. The first write
+// using an ID carries the label to bind to it, and later ones leave the label out.
+#define ZMK_SPLIT_BEHAVIOR_IDS_MAX 16
+// Runs the behavior with the label sent along, without binding an ID to it.
+#define ZMK_SPLIT_BEHAVIOR_ID_NONE 0xFF
+
+struct zmk_split_run_behavior_id_payload {
+    struct zmk_split_run_behavior_data data;
+    uint8_t behavior_id;
+    char behavior_dev[ZMK_SPLIT_RUN_BEHAVIOR_DEV_LEN];
+} __packed;
+
+int zmk_split_bt_position_pressed(uint8_t position, int64_t timestamp);
+int zmk_split_bt_position_released(uint8_t position, int64_t timestamp);
 int zmk_split_bt_sensor_triggered(uint8_t sensor_index,
                                   const struct zmk_sensor_channel_data channel_data[],
                                   size_t channel_data_size);
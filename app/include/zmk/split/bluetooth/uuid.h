@@ -17,3 +17,6 @@
 #define ZMK_SPLIT_BT_CHAR_POSITION_STATE_UUID ZMK_BT_SPLIT_UUID(0x00000001)
 #define ZMK_SPLIT_BT_CHAR_RUN_BEHAVIOR_UUID ZMK_BT_SPLIT_UUID(0x00000002)
 #define ZMK_SPLIT_BT_CHAR_SENSOR_STATE_UUID ZMK_BT_SPLIT_UUID(0x00000003)
+#define ZMK_SPLIT_BT_CHAR_POSITION_EVENTS_UUID ZMK_BT_SPLIT_UUID(0x00000004)
+#define ZMK_SPLIT_BT_CHAR_CLOCK_UUID ZMK_BT_SPLIT_UUID(0x00000005)
+#define ZMK_SPLIT_BT_CHAR_RUN_BEHAVIOR_ID_UUID ZMK_BT_SPLIT_UUID(0x00000006)
@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+// Types out ASCII text as keyboard reports, assuming the host uses a US keyboard layout. The text
+// must stay valid until it has been sent, which is the case for devicetree strings. Texts sent
+// while another one is still being typed out are queued behind it.
+int zmk_string_sender_send(const char *text);
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/dlist.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct zmk_timer;
+
+typedef void (*zmk_timer_handler_t)(struct zmk_timer *timer);
+
+// A one-shot timeout serviced by the shared ZMK timer wheel. All timers share a single kernel
+// timeout armed for the earliest pending deadline. Timers must only be started and stopped from the
+// system work queue, which is also where their handlers run, so a stopped timer never fires.
+struct zmk_timer {
+    sys_dnode_t node;
+    zmk_timer_handler_t handler;
+    // Absolute deadline in milliseconds of uptime, as passed to zmk_timer_start().
+    int64_t deadline;
+    // Wheel tick the timer is filed under. Equal to the deadline unless that tick had already been
+    // dispatched when the timer was started.
+    int64_t tick;
+};
+
+void zmk_timer_init(struct zmk_timer *timer, zmk_timer_handler_t handler);
+
+// (Re)starts the timer so its handler runs once k_uptime_get() reaches the deadline. Timers that
+// share a deadline run in the order they were started. Deadlines in the past run as soon as
+// possible.
+void zmk_timer_start(struct zmk_timer *timer, int64_t deadline);
+
+void zmk_timer_stop(struct zmk_timer *timer);
+
+static inline bool zmk_timer_is_pending(const struct zmk_timer *timer) {
+    return sys_dnode_is_linked(&timer->node);
+}
@@ -6,4 +6,10 @@
 
 #pragma once
 
-int zmk_usb_hid_send_report(const uint8_t *report, size_t len);
\ No newline at end of file
+#include <stdbool.h>
+
+int zmk_usb_hid_send_report(const uint8_t *report, size_t len);
+
+// Whether the previous report on the interface carrying reports with the given ID has been picked
+// up by the host, so another one goes out right away instead of being queued.
+bool zmk_usb_hid_is_ready(uint8_t report_id);
\ No newline at end of file
@@ -5,62 +5,215 @@
  */
 
 #include <zmk/behavior_queue.h>
+#include <zmk/timer_wheel.h>
 
+#include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <drivers/behavior.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
-struct q_item {
+struct q_lane {
+    struct zmk_timer timer;
     uint32_t position;
+    // Lanes on the same position run in the order they were added.
+    uint32_t order;
+    bool in_use;
+    bool started;
+    zmk_behavior_queue_next_t next;
+    uint8_t context[ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE] __aligned(8);
+};
+
+// Context of lanes added through zmk_behavior_queue_add. A press directly followed by a release
+// for the same position shares one lane.
+struct q_bindings {
+    struct zmk_behavior_queue_step steps[2];
+    uint8_t count;
+    uint8_t index;
+};
+
+// Context of lanes added through zmk_behavior_queue_add_taps. Further taps of the same binding
+// on the position are counted into the newest lane instead of taking up lanes of their own.
+struct q_taps {
     struct zmk_behavior_binding binding;
-    bool press : 1;
-    uint32_t wait : 31;
+    uint32_t tap_ms;
+    uint32_t remaining;
+    bool pressed;
 };
 
-K_MSGQ_DEFINE(zmk_behavior_queue_msgq, sizeof(struct q_item), CONFIG_ZMK_BEHAVIORS_QUEUE_SIZE, 4);
+BUILD_ASSERT(sizeof(struct q_bindings) <= ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE,
+             "ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE is too small");
+BUILD_ASSERT(sizeof(struct q_taps) <= ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE,
+             "ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE is too small");
+
+static struct q_lane lanes[CONFIG_ZMK_BEHAVIORS_QUEUE_LANES];
+static uint32_t next_order;
+
+static bool q_bindings_next(void *context, struct zmk_behavior_queue_step *step) {
+    struct q_bindings *bindings = context;
+    if (bindings->index >= bindings->count) {
+        return false;
+    }
+    *step = bindings->steps[bindings->index++];
+    return true;
+}
+
+static bool q_taps_next(void *context, struct zmk_behavior_queue_step *step) {
+    struct q_taps *taps = context;
+    if (taps->pressed) {
+        taps->pressed = false;
+        taps->remaining--;
+        *step = (struct zmk_behavior_queue_step){.binding = taps->binding, .press = false};
+        return true;
+    }
+    if (taps->remaining == 0) {
+        return false;
+    }
+    taps->pressed = true;
+    *step = (struct zmk_behavior_queue_step){
+        .binding = taps->binding, .press = true, .wait = taps->tap_ms};
+    return true;
+}
+
+// Returns the lane for the position that was added first among those matching `started`.
+static struct q_lane *find_lane(uint32_t position, bool started) {
+    struct q_lane *found = NULL;
+    for (int i = 0; i < CONFIG_ZMK_BEHAVIORS_QUEUE_LANES; i++) {
+        struct q_lane *lane = &lanes[i];
+        if (!lane->in_use || lane->position != position || lane->started != started) {
+            continue;
+        }
+        if (found == NULL || (int32_t)(lane->order - found->order) < 0) {
+            found = lane;
+        }
+    }
+    return found;
+}
+
+static struct q_lane *find_newest_lane(uint32_t position) {
+    struct q_lane *found = NULL;
+    for (int i = 0; i < CONFIG_ZMK_BEHAVIORS_QUEUE_LANES; i++) {
+        struct q_lane *lane = &lanes[i];
+        if (lane->in_use && lane->position == position &&
+            (found == NULL || (int32_t)(lane->order - found->order) > 0)) {
+            found = lane;
+        }
+    }
+    return found;
+}
+
+// Invokes steps until the lane has to wait, then hands over to the next lane on the position once
+// it is done.
+static void behavior_queue_process_next(struct q_lane *lane) {
+    while (lane != NULL) {
+        struct zmk_behavior_queue_step step;
+
+        while (lane->next(lane->context, &step)) {
+            LOG_DBG("Invoking %s: 0x%02x 0x%02x", step.binding.behavior_dev, step.binding.param1,
+                    step.binding.param2);
 
-static void behavior_queue_process_next(struct k_work *work);
-static K_WORK_DELAYABLE_DEFINE(queue_work, behavior_queue_process_next);
+            struct zmk_behavior_binding_event event = {.position = lane->position,
+                                                       .timestamp = k_uptime_get()};
 
-static void behavior_queue_process_next(struct k_work *work) {
-    struct q_item item = {.wait = 0};
+            if (step.press) {
+                behavior_keymap_binding_pressed(&step.binding, event);
+            } else {
+                behavior_keymap_binding_released(&step.binding, event);
+            }
 
-    while (k_msgq_get(&zmk_behavior_queue_msgq, &item, K_NO_WAIT) == 0) {
-        LOG_DBG("Invoking %s: 0x%02x 0x%02x", item.binding.behavior_dev, item.binding.param1,
-                item.binding.param2);
+            LOG_DBG("Processing next queued behavior in %dms", step.wait);
 
-        struct zmk_behavior_binding_event event = {.position = item.position,
-                                                   .timestamp = k_uptime_get()};
+            if (step.wait > 0) {
+                zmk_timer_start(&lane->timer, k_uptime_get() + step.wait);
+                return;
+            }
+        }
 
-        if (item.press) {
-            behavior_keymap_binding_pressed(&item.binding, event);
-        } else {
-            behavior_keymap_binding_released(&item.binding, event);
+        lane->in_use = false;
+        lane = find_lane(lane->position, false);
+        if (lane != NULL) {
+            lane->started = true;
         }
+    }
+}
 
-        LOG_DBG("Processing next queued behavior in %dms", item.wait);
+static void behavior_queue_timer_handler(struct zmk_timer *timer) {
+    behavior_queue_process_next(CONTAINER_OF(timer, struct q_lane, timer));
+}
 
-        if (item.wait > 0) {
-            k_work_schedule(&queue_work, K_MSEC(item.wait));
+int zmk_behavior_queue_add_lane(uint32_t position, zmk_behavior_queue_next_t next,
+                                const void *context, size_t context_size) {
+    if (context_size > ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE) {
+        return -EINVAL;
+    }
+
+    struct q_lane *lane = NULL;
+    for (int i = 0; i < CONFIG_ZMK_BEHAVIORS_QUEUE_LANES; i++) {
+        if (!lanes[i].in_use) {
+            lane = &lanes[i];
             break;
         }
     }
+    if (lane == NULL) {
+        LOG_ERR("Unable to queue behaviors, more than %d lanes in use",
+                CONFIG_ZMK_BEHAVIORS_QUEUE_LANES);
+        return -ENOMEM;
+    }
+
+    // Added lanes may be kicked off from within another lane's step, which reentrantly invokes
+    // this. Only start the lane right away if nothing else is queued for its position.
+    bool start = find_newest_lane(position) == NULL;
+
+    zmk_timer_init(&lane->timer, behavior_queue_timer_handler);
+    lane->position = position;
+    lane->order = next_order++;
+    lane->in_use = true;
+    lane->started = start;
+    lane->next = next;
+    memcpy(lane->context, context, context_size);
+
+    if (start) {
+        behavior_queue_process_next(lane);
+    }
+
+    return 0;
 }
 
 int zmk_behavior_queue_add(uint32_t position, const struct zmk_behavior_binding binding, bool press,
                            uint32_t wait) {
-    struct q_item item = {.press = press, .binding = binding, .wait = wait};
+    struct zmk_behavior_queue_step step = {.binding = binding, .press = press, .wait = wait};
+
+    struct q_lane *newest = find_newest_lane(position);
+    if (newest != NULL && newest->next == q_bindings_next) {
+        struct q_bindings *bindings = (struct q_bindings *)newest->context;
+        if (bindings->count < ARRAY_SIZE(bindings->steps)) {
+            bindings->steps[bindings->count++] = step;
+            return 0;
+        }
+    }
+
+    struct q_bindings bindings = {.steps = {step}, .count = 1};
+    return zmk_behavior_queue_add_lane(position, q_bindings_next, &bindings, sizeof(bindings));
+}
 
-    const int ret = k_msgq_put(&zmk_behavior_queue_msgq, &item, K_NO_WAIT);
-    if (ret < 0) {
-        return ret;
+int zmk_behavior_queue_add_taps(uint32_t position, const struct zmk_behavior_binding binding,
+                                uint32_t tap_ms, uint32_t count) {
+    if (count == 0) {
+        return 0;
     }
 
-    if (!k_work_delayable_is_pending(&queue_work)) {
-        behavior_queue_process_next(&queue_work.work);
+    struct q_lane *newest = find_newest_lane(position);
+    if (newest != NULL && newest->next == q_taps_next) {
+        struct q_taps *taps = (struct q_taps *)newest->context;
+        if (taps->tap_ms == tap_ms && taps->binding.param1 == binding.param1 &&
+            taps->binding.param2 == binding.param2 &&
+            strcmp(taps->binding.behavior_dev, binding.behavior_dev) == 0) {
+            taps->remaining += count;
+            return 0;
+        }
     }
 
-    return 0;
+    struct q_taps taps = {.binding = binding, .tap_ms = tap_ms, .remaining = count};
+    return zmk_behavior_queue_add_lane(position, q_taps_next, &taps, sizeof(taps));
 }
@@ -19,22 +19,23 @@
 #include <zmk/events/keycode_state_changed.h>
 #include <zmk/behavior.h>
 #include <zmk/keymap.h>
+#include <zmk/timer_wheel.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
 
-#define ZMK_BHV_HOLD_TAP_MAX_HELD 10
+#define ZMK_BHV_HOLD_TAP_MAX_HELD CONFIG_ZMK_BEHAVIOR_HOLD_TAP_MAX_HELD
 #define ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS 40
 
-// increase if you have keyboard with more keys.
-#define ZMK_BHV_HOLD_TAP_POSITION_NOT_USED 9999
+BUILD_ASSERT(ZMK_BHV_HOLD_TAP_MAX_HELD <= 32, "active hold-taps are tracked in a 32 bit mask");
 
 enum flavor {
     FLAVOR_HOLD_PREFERRED,
     FLAVOR_BALANCED,
     FLAVOR_TAP_PREFERRED,
     FLAVOR_TAP_UNLESS_INTERRUPTED,
+    FLAVOR_PREDICTIVE,
 };
 
 enum status {
@@ -73,23 +74,78 @@ struct active_hold_tap {
     int64_t timestamp;
     enum status status;
     const struct behavior_hold_tap_config *config;
-    struct k_work_delayable work;
-    bool work_is_cancelled;
+    struct zmk_timer timer;
+    // slot plus one of the next hold-tap nested at the same key position, zero for none
+    uint8_t next_at_position;
+    // index of the first event in the captured events ring belonging to this hold-tap
+    uint32_t captured_events_start;
 
     // initialized to -1, which is to be interpreted as "no other key has been pressed yet"
     int32_t position_of_first_other_key_pressed;
     int32_t position_of_first_other_key_released;
+
+    // First key pressed while this hold-tap was held, also after it has been decided, and
+    // whether that key was released first. Used to learn typing rhythm for the predictive flavor.
+    int32_t position_of_first_interrupt;
+    int64_t timestamp_of_first_interrupt;
+    bool first_interrupt_released;
 };
 
 // The undecided hold tap is the hold tap that needs to be decided before
 // other keypress events can be released. While the undecided_hold_tap is
 // not NULL, most events are captured in captured_events.
 // After the hold_tap is decided, it will stay in the active_hold_taps until
-// its key-up has been processed and the delayed work is cleaned up.
+// its key-up has been processed.
 struct active_hold_tap *undecided_hold_tap = NULL;
 struct active_hold_tap active_hold_taps[ZMK_BHV_HOLD_TAP_MAX_HELD] = {};
+// bit i is set while active_hold_taps[i] is in use.
+uint32_t active_hold_taps_mask;
+// Slot in active_hold_taps plus one for every key position with an active hold-tap, zero otherwise.
+// Hold-taps nested at the same position, e.g. a hold-tap in another hold-tap's hold binding, are
+// chained from the outermost one through next_at_position. Hold-taps on virtual key positions,
+// e.g. from combos, are found by scanning the active slots.
+uint8_t hold_tap_slot_by_position[ZMK_KEYMAP_LEN] = {};
 // We capture most position_state_changed events and some modifiers_state_changed events.
+// Captured events form a ring; released slots are set to NULL and the head skips past them.
 const zmk_event_t *captured_events[ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS] = {};
+uint32_t captured_events_head;
+uint32_t captured_events_tail;
+// Ring index of the latest key-down event captured for every key position. Only meaningful while
+// that slot of the ring still holds the event, which find_captured_keydown_event checks.
+uint32_t captured_keydown_by_position[ZMK_KEYMAP_LEN] = {};
+
+#define IS_PREDICTIVE_INST(n) (DT_ENUM_IDX(DT_DRV_INST(n), flavor) == FLAVOR_PREDICTIVE) ||
+
+// Only keep statistics if at least one instance uses the predictive flavor.
+#define PREDICTIVE_STATS_LEN                                                                       \
+    ((DT_INST_FOREACH_STATUS_OKAY(IS_PREDICTIVE_INST) false) ? ZMK_KEYMAP_LEN : 1)
+
+// Each new sample weighs 1/4 in the moving averages below.
+#define PREDICTIVE_EWMA_SHIFT 2
+
+#define PREDICTIVE_CONFIDENCE                                                                      \
+    ((uint16_t)((CONFIG_ZMK_BEHAVIOR_HOLD_TAP_PREDICTIVE_CONFIDENCE * UINT16_MAX) / 100))
+
+// Typing rhythm of a key position, learned from presses that were interrupted by another key.
+struct predictive_stats {
+    // moving average of how often an interrupted press was a hold, in 1/65535ths.
+    uint16_t hold_ratio;
+    // moving average of the time until the interrupting key was pressed, for presses that were
+    // taps rolling into the next key.
+    uint16_t roll_interval_ms;
+    uint8_t samples;
+};
+
+struct predictive_stats predictive_stats[PREDICTIVE_STATS_LEN] = {};
+
+#if IS_ENABLED(CONFIG_ZMK_BEHAVIOR_HOLD_TAP_DECISION_STATS)
+
+// Bucket 0 counts decisions made within 8ms of the press, every further bucket doubles that.
+#define DECISION_LATENCY_BUCKETS 8
+
+uint32_t decision_latency[FLAVOR_PREDICTIVE + 1][DECISION_LATENCY_BUCKETS] = {};
+
+#endif
 
 // Keep track of which key was tapped most recently for the standard, if it is a hold-tap
 // a position, will be given, if not it will just be INT32_MIN
@@ -123,22 +179,46 @@ static bool is_quick_tap(struct active_hold_tap *hold_tap) {
     }
 }
 
+#define CAPTURED_EVENT_SLOT(index) captured_events[(index) % ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS]
+
 static int capture_event(const zmk_event_t *event) {
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS; i++) {
-        if (captured_events[i] == NULL) {
-            captured_events[i] = event;
-            return 0;
-        }
+    if (captured_events_tail - captured_events_head >= ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS) {
+        LOG_ERR("unable to capture event, more than %d events captured by hold-taps",
+                ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS);
+        return -ENOMEM;
+    }
+    struct zmk_position_state_changed *position_event = as_zmk_position_state_changed(event);
+    if (position_event != NULL && position_event->state &&
+        position_event->position < ZMK_KEYMAP_LEN) {
+        captured_keydown_by_position[position_event->position] = captured_events_tail;
     }
-    return -ENOMEM;
+    CAPTURED_EVENT_SLOT(captured_events_tail++) = event;
+    return 0;
 }
 
-static struct zmk_position_state_changed *find_captured_keydown_event(uint32_t position) {
+static struct zmk_position_state_changed *
+find_captured_keydown_event(struct active_hold_tap *hold_tap, uint32_t position) {
+    if (position < ZMK_KEYMAP_LEN) {
+        uint32_t index = captured_keydown_by_position[position];
+        if (index - hold_tap->captured_events_start >=
+            captured_events_tail - hold_tap->captured_events_start) {
+            return NULL;
+        }
+        const zmk_event_t *eh = CAPTURED_EVENT_SLOT(index);
+        struct zmk_position_state_changed *position_event =
+            eh != NULL ? as_zmk_position_state_changed(eh) : NULL;
+        if (position_event == NULL || position_event->position != position ||
+            !position_event->state) {
+            return NULL;
+        }
+        return position_event;
+    }
+
     struct zmk_position_state_changed *last_match = NULL;
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS; i++) {
-        const zmk_event_t *eh = captured_events[i];
+    for (uint32_t i = hold_tap->captured_events_start; i != captured_events_tail; i++) {
+        const zmk_event_t *eh = CAPTURED_EVENT_SLOT(i);
         if (eh == NULL) {
-            return last_match;
+            continue;
         }
         struct zmk_position_state_changed *position_event = as_zmk_position_state_changed(eh);
         if (position_event == NULL) {
@@ -154,44 +234,38 @@ static struct zmk_position_state_changed *find_captured_keydown_event(uint32_t p
 
 const struct zmk_listener zmk_listener_behavior_hold_tap;
 
-static void release_captured_events() {
+static void release_captured_events(struct active_hold_tap *hold_tap) {
     if (undecided_hold_tap != NULL) {
         return;
     }
 
-    // We use a trick to prevent copying the captured_events array.
-    //
-    // Events for different mod-tap instances are separated by a NULL pointer.
-    //
-    // The first event popped will never be catched by the next active hold-tap
-    // because to start capturing a mod-tap-key-down event must first completely
-    // go through the events queue.
+    // The events this hold-tap captured are the segment from its start up to the current tail.
+    // Re-raising them can make another hold-tap undecided, which then captures the rest of this
+    // segment again as a new segment after the tail. If that hold-tap is decided while we are
+    // still releasing, it releases its own segment first, which keeps events in order.
     //
     // Example of this release process;
-    // [mt2_down, k1_down, k1_up, mt2_up, null, ...]
+    // [mt2_down, k1_down, k1_up, mt2_up]
     //  ^
     // mt2_down position event isn't captured because no hold-tap is active.
     // mt2_down behavior event is handled, now we have an undecided hold-tap
-    // [null, k1_down, k1_up, mt2_up, null, ...]
+    // [null, k1_down, k1_up, mt2_up | ]
     //        ^
-    // k1_down  is captured by the mt2 mod-tap
-    // !note that searches for find_captured_keydown_event by the mt2 behavior will stop at the
-    // first null encountered [mt1_down, null, k1_up, mt2_up, null, ...]
-    //                  ^
-    // k1_up event is captured by the new hold-tap:
-    // [k1_down, k1_up, null, mt2_up, null, ...]
-    //                        ^
-    // mt2_up event is not captured but causes release of mt2 behavior
-    // [k1_down, k1_up, null, null, null, ...]
-    // now mt2 will start releasing it's own captured positions.
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS; i++) {
-        const zmk_event_t *captured_event = captured_events[i];
+    // k1_down and k1_up are captured by the mt2 hold-tap into its own segment:
+    // [null, null, null, mt2_up | k1_down, k1_up]
+    //                    ^
+    // mt2_up event is not captured but causes release of mt2 behavior, which releases
+    // k1_down and k1_up before we move on.
+    uint32_t end = captured_events_tail;
+    for (uint32_t i = hold_tap->captured_events_start; i != end; i++) {
+        const zmk_event_t *captured_event = CAPTURED_EVENT_SLOT(i);
         if (captured_event == NULL) {
-            return;
+            continue;
         }
-        captured_events[i] = NULL;
-        if (undecided_hold_tap != NULL) {
-            k_msleep(10);
+        CAPTURED_EVENT_SLOT(i) = NULL;
+        while (captured_events_head != captured_events_tail &&
+               CAPTURED_EVENT_SLOT(captured_events_head) == NULL) {
+            captured_events_head++;
         }
 
         struct zmk_position_state_changed *position_event;
@@ -208,9 +282,15 @@ static void release_captured_events() {
 }
 
 static struct active_hold_tap *find_hold_tap(uint32_t position) {
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_HELD; i++) {
-        if (active_hold_taps[i].position == position) {
-            return &active_hold_taps[i];
+    if (position < ZMK_KEYMAP_LEN) {
+        uint8_t slot = hold_tap_slot_by_position[position];
+        return slot != 0 ? &active_hold_taps[slot - 1] : NULL;
+    }
+
+    for (uint32_t mask = active_hold_taps_mask; mask != 0; mask &= mask - 1) {
+        struct active_hold_tap *hold_tap = &active_hold_taps[find_lsb_set(mask) - 1];
+        if (hold_tap->position == position) {
+            return hold_tap;
         }
     }
     return NULL;
@@ -219,27 +299,56 @@ static struct active_hold_tap *find_hold_tap(uint32_t position) {
 static struct active_hold_tap *store_hold_tap(uint32_t position, uint32_t param_hold,
                                               uint32_t param_tap, int64_t timestamp,
                                               const struct behavior_hold_tap_config *config) {
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_HELD; i++) {
-        if (active_hold_taps[i].position != ZMK_BHV_HOLD_TAP_POSITION_NOT_USED) {
-            continue;
+    int slot = find_lsb_set(~active_hold_taps_mask) - 1;
+    if (slot < 0 || slot >= ZMK_BHV_HOLD_TAP_MAX_HELD) {
+        return NULL;
+    }
+
+    struct active_hold_tap *hold_tap = &active_hold_taps[slot];
+    active_hold_taps_mask |= BIT(slot);
+    hold_tap->next_at_position = 0;
+    if (position < ZMK_KEYMAP_LEN) {
+        uint8_t *link = &hold_tap_slot_by_position[position];
+        while (*link != 0) {
+            link = &active_hold_taps[*link - 1].next_at_position;
         }
-        active_hold_taps[i].position = position;
-        active_hold_taps[i].status = STATUS_UNDECIDED;
-        active_hold_taps[i].config = config;
-        active_hold_taps[i].param_hold = param_hold;
-        active_hold_taps[i].param_tap = param_tap;
-        active_hold_taps[i].timestamp = timestamp;
-        active_hold_taps[i].position_of_first_other_key_pressed = -1;
-        active_hold_taps[i].position_of_first_other_key_released = -1;
-        return &active_hold_taps[i];
+        *link = slot + 1;
+    }
+
+    hold_tap->position = position;
+    hold_tap->status = STATUS_UNDECIDED;
+    hold_tap->config = config;
+    hold_tap->param_hold = param_hold;
+    hold_tap->param_tap = param_tap;
+    hold_tap->timestamp = timestamp;
+    hold_tap->position_of_first_other_key_pressed = -1;
+    hold_tap->position_of_first_other_key_released = -1;
+    hold_tap->position_of_first_interrupt = -1;
+    hold_tap->first_interrupt_released = false;
+    return hold_tap;
+}
+
+static void unlink_hold_tap(struct active_hold_tap *hold_tap) {
+    if (hold_tap->position >= ZMK_KEYMAP_LEN) {
+        return;
+    }
+
+    int slot = hold_tap - active_hold_taps;
+    uint8_t *link = &hold_tap_slot_by_position[hold_tap->position];
+    while (*link != 0) {
+        if (*link == slot + 1) {
+            *link = hold_tap->next_at_position;
+            hold_tap->next_at_position = 0;
+            return;
+        }
+        link = &active_hold_taps[*link - 1].next_at_position;
     }
-    return NULL;
 }
 
 static void clear_hold_tap(struct active_hold_tap *hold_tap) {
-    hold_tap->position = ZMK_BHV_HOLD_TAP_POSITION_NOT_USED;
+    active_hold_taps_mask &= ~BIT(hold_tap - active_hold_taps);
+    unlink_hold_tap(hold_tap);
     hold_tap->status = STATUS_UNDECIDED;
-    hold_tap->work_is_cancelled = false;
 }
 
 static void decide_balanced(struct active_hold_tap *hold_tap, enum decision_moment event) {
@@ -316,6 +425,32 @@ static void decide_hold_preferred(struct active_hold_tap *hold_tap, enum decisio
     }
 }
 
+static void decide_predictive(struct active_hold_tap *hold_tap, enum decision_moment event) {
+    if (event != HT_OTHER_KEY_DOWN || hold_tap->position >= PREDICTIVE_STATS_LEN) {
+        decide_balanced(hold_tap, event);
+        return;
+    }
+
+    // Without enough confidence either way, wait for the other key to be released like the
+    // balanced flavor does. The tapping term timer still decides if nothing else happens.
+    const struct predictive_stats *stats = &predictive_stats[hold_tap->position];
+    if (stats->samples < CONFIG_ZMK_BEHAVIOR_HOLD_TAP_PREDICTIVE_MIN_SAMPLES) {
+        return;
+    }
+
+    if (stats->hold_ratio >= PREDICTIVE_CONFIDENCE) {
+        hold_tap->status = STATUS_HOLD_INTERRUPT;
+        return;
+    }
+
+    // A roll only looks like a roll if the next key came about as quickly as it usually does.
+    int64_t interval = hold_tap->timestamp_of_first_interrupt - hold_tap->timestamp;
+    if (stats->hold_ratio <= UINT16_MAX - PREDICTIVE_CONFIDENCE &&
+        interval <= 2 * stats->roll_interval_ms) {
+        hold_tap->status = STATUS_TAP;
+    }
+}
+
 static inline const char *flavor_str(enum flavor flavor) {
     switch (flavor) {
     case FLAVOR_HOLD_PREFERRED:
@@ -326,6 +461,8 @@ static inline const char *flavor_str(enum flavor flavor) {
         return "tap-preferred";
     case FLAVOR_TAP_UNLESS_INTERRUPTED:
         return "tap-unless-interrupted";
+    case FLAVOR_PREDICTIVE:
+        return "predictive";
     default:
         return "UNKNOWN FLAVOR";
     }
@@ -485,6 +622,22 @@ static void decide_positional_hold(struct active_hold_tap *hold_tap) {
     return; // ignore flavor, set TAP
 }
 
+#if IS_ENABLED(CONFIG_ZMK_BEHAVIOR_HOLD_TAP_DECISION_STATS)
+static void record_decision_latency(struct active_hold_tap *hold_tap) {
+    int64_t latency = k_uptime_get() - hold_tap->timestamp;
+    int bucket = 0;
+    while (bucket < DECISION_LATENCY_BUCKETS - 1 && latency >= (8 << bucket)) {
+        bucket++;
+    }
+
+    uint32_t *histogram = decision_latency[hold_tap->config->flavor];
+    histogram[bucket]++;
+    LOG_DBG("%s decision latency (<8 <16 <32 <64 <128 <256 <512 >=512ms): %d %d %d %d %d %d %d %d",
+            flavor_str(hold_tap->config->flavor), histogram[0], histogram[1], histogram[2],
+            histogram[3], histogram[4], histogram[5], histogram[6], histogram[7]);
+}
+#endif
+
 static void decide_hold_tap(struct active_hold_tap *hold_tap,
                             enum decision_moment decision_moment) {
     if (hold_tap->status != STATUS_UNDECIDED) {
@@ -510,6 +663,9 @@ static void decide_hold_tap(struct active_hold_tap *hold_tap,
     case FLAVOR_TAP_UNLESS_INTERRUPTED:
         decide_tap_unless_interrupted(hold_tap, decision_moment);
         break;
+    case FLAVOR_PREDICTIVE:
+        decide_predictive(hold_tap, decision_moment);
+        break;
     }
 
     if (hold_tap->status == STATUS_UNDECIDED) {
@@ -526,9 +682,12 @@ static void decide_hold_tap(struct active_hold_tap *hold_tap,
     LOG_DBG("%d decided %s (%s decision moment %s)", hold_tap->position,
             status_str(hold_tap->status), flavor_str(hold_tap->config->flavor),
             decision_moment_str(decision_moment));
+#if IS_ENABLED(CONFIG_ZMK_BEHAVIOR_HOLD_TAP_DECISION_STATS)
+    record_decision_latency(hold_tap);
+#endif
     undecided_hold_tap = NULL;
     press_binding(hold_tap);
-    release_captured_events();
+    release_captured_events(hold_tap);
 }
 
 static void decide_retro_tap(struct active_hold_tap *hold_tap) {
@@ -545,11 +704,9 @@ static void decide_retro_tap(struct active_hold_tap *hold_tap) {
 }
 
 static void update_hold_status_for_retro_tap(uint32_t ignore_position) {
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_HELD; i++) {
-        struct active_hold_tap *hold_tap = &active_hold_taps[i];
-        if (hold_tap->position == ignore_position ||
-            hold_tap->position == ZMK_BHV_HOLD_TAP_POSITION_NOT_USED ||
-            hold_tap->config->retro_tap == false) {
+    for (uint32_t mask = active_hold_taps_mask; mask != 0; mask &= mask - 1) {
+        struct active_hold_tap *hold_tap = &active_hold_taps[find_lsb_set(mask) - 1];
+        if (hold_tap->position == ignore_position || hold_tap->config->retro_tap == false) {
             continue;
         }
         if (hold_tap->status == STATUS_HOLD_TIMER) {
@@ -560,6 +717,43 @@ static void update_hold_status_for_retro_tap(uint32_t ignore_position) {
     }
 }
 
+// Learns from how an interrupted press turned out: the interrupting key being released first means
+// the hold-tap was held on purpose, the hold-tap being released first means it was a rolled tap.
+static void update_predictive_stats(struct active_hold_tap *hold_tap) {
+    if (hold_tap->config->flavor != FLAVOR_PREDICTIVE ||
+        hold_tap->position >= PREDICTIVE_STATS_LEN || hold_tap->position_of_first_interrupt == -1) {
+        return;
+    }
+
+    struct predictive_stats *stats = &predictive_stats[hold_tap->position];
+    uint16_t outcome = hold_tap->first_interrupt_released ? UINT16_MAX : 0;
+    if (stats->samples == 0) {
+        stats->hold_ratio = outcome;
+    } else {
+        stats->hold_ratio = stats->hold_ratio - (stats->hold_ratio >> PREDICTIVE_EWMA_SHIFT) +
+                            (outcome >> PREDICTIVE_EWMA_SHIFT);
+    }
+
+    if (!hold_tap->first_interrupt_released) {
+        uint16_t interval =
+            MIN(hold_tap->timestamp_of_first_interrupt - hold_tap->timestamp, UINT16_MAX);
+        if (stats->roll_interval_ms == 0) {
+            stats->roll_interval_ms = interval;
+        } else {
+            stats->roll_interval_ms = stats->roll_interval_ms -
+                                      (stats->roll_interval_ms >> PREDICTIVE_EWMA_SHIFT) +
+                                      (interval >> PREDICTIVE_EWMA_SHIFT);
+        }
+    }
+
+    if (stats->samples < UINT8_MAX) {
+        stats->samples++;
+    }
+
+    LOG_DBG("%d hold ratio %d%% roll interval %dms samples %d", hold_tap->position,
+            stats->hold_ratio * 100 / UINT16_MAX, stats->roll_interval_ms, stats->samples);
+}
+
 static int on_hold_tap_binding_pressed(struct zmk_behavior_binding *binding,
                                        struct zmk_behavior_binding_event event) {
     const struct device *dev = device_get_binding(binding->behavior_dev);
@@ -581,15 +775,14 @@ static int on_hold_tap_binding_pressed(struct zmk_behavior_binding *binding,
 
     LOG_DBG("%d new undecided hold_tap", event.position);
     undecided_hold_tap = hold_tap;
+    hold_tap->captured_events_start = captured_events_tail;
 
     if (is_quick_tap(hold_tap)) {
         decide_hold_tap(hold_tap, HT_QUICK_TAP);
     }
 
-    // if this behavior was queued we have to adjust the timer to only
-    // wait for the remaining time.
-    int32_t tapping_term_ms_left = (hold_tap->timestamp + cfg->tapping_term_ms) - k_uptime_get();
-    k_work_schedule(&hold_tap->work, K_MSEC(tapping_term_ms_left));
+    // if this behavior was queued, the deadline may already be close or in the past.
+    zmk_timer_start(&hold_tap->timer, hold_tap->timestamp + cfg->tapping_term_ms);
 
     return ZMK_BEHAVIOR_OPAQUE;
 }
@@ -602,9 +795,12 @@ static int on_hold_tap_binding_released(struct zmk_behavior_binding *binding,
         return ZMK_BEHAVIOR_OPAQUE;
     }
 
+    // A hold-tap nested in this one's binding is released below and must find itself instead.
+    unlink_hold_tap(hold_tap);
+
     // If these events were queued, the timer event may be queued too late or not at all.
     // We insert a timer event before the TH_KEY_UP event to verify.
-    int work_cancel_result = k_work_cancel_delayable(&hold_tap->work);
+    zmk_timer_stop(&hold_tap->timer);
     if (event.timestamp > (hold_tap->timestamp + hold_tap->config->tapping_term_ms)) {
         decide_hold_tap(hold_tap, HT_TIMER_EVENT);
     }
@@ -612,16 +808,10 @@ static int on_hold_tap_binding_released(struct zmk_behavior_binding *binding,
     decide_hold_tap(hold_tap, HT_KEY_UP);
     decide_retro_tap(hold_tap);
     release_binding(hold_tap);
+    update_predictive_stats(hold_tap);
 
-    if (work_cancel_result == -EINPROGRESS) {
-        // let the timer handler clean up
-        // if we'd clear now, the timer may call back for an uninitialized active_hold_tap.
-        LOG_DBG("%d hold-tap timer work in event queue", event.position);
-        hold_tap->work_is_cancelled = true;
-    } else {
-        LOG_DBG("%d cleaning up hold-tap", event.position);
-        clear_hold_tap(hold_tap);
-    }
+    LOG_DBG("%d cleaning up hold-tap", event.position);
+    clear_hold_tap(hold_tap);
 
     return ZMK_BEHAVIOR_OPAQUE;
 }
@@ -631,10 +821,28 @@ static const struct behavior_driver_api behavior_hold_tap_driver_api = {
     .binding_released = on_hold_tap_binding_released,
 };
 
+static void track_interrupts(const struct zmk_position_state_changed *ev) {
+    for (uint32_t mask = active_hold_taps_mask; mask != 0; mask &= mask - 1) {
+        struct active_hold_tap *hold_tap = &active_hold_taps[find_lsb_set(mask) - 1];
+        if (hold_tap->position == ev->position || hold_tap->config->flavor != FLAVOR_PREDICTIVE) {
+            continue;
+        }
+        // Keys already held when the hold-tap was pressed don't count as interrupting it.
+        if (ev->state && hold_tap->position_of_first_interrupt == -1 &&
+            ev->timestamp >= hold_tap->timestamp) {
+            hold_tap->position_of_first_interrupt = ev->position;
+            hold_tap->timestamp_of_first_interrupt = ev->timestamp;
+        } else if (!ev->state && ev->position == hold_tap->position_of_first_interrupt) {
+            hold_tap->first_interrupt_released = true;
+        }
+    }
+}
+
 static int position_state_changed_listener(const zmk_event_t *eh) {
     struct zmk_position_state_changed *ev = as_zmk_position_state_changed(eh);
 
     update_hold_status_for_retro_tap(ev->position);
+    track_interrupts(ev);
 
     if (undecided_hold_tap == NULL) {
         LOG_DBG("%d bubble (no undecided hold_tap active)", ev->position);
@@ -674,7 +882,7 @@ static int position_state_changed_listener(const zmk_event_t *eh) {
         return ZMK_EV_EVENT_BUBBLE;
     }
 
-    if (!ev->state && find_captured_keydown_event(ev->position) == NULL) {
+    if (!ev->state && find_captured_keydown_event(undecided_hold_tap, ev->position) == NULL) {
         // no keydown event has been captured, let it bubble.
         // we'll catch modifiers later in modifier_state_changed_listener
         LOG_DBG("%d bubbling %d %s event", undecided_hold_tap->position, ev->position,
@@ -684,7 +892,9 @@ static int position_state_changed_listener(const zmk_event_t *eh) {
 
     LOG_DBG("%d capturing %d %s event", undecided_hold_tap->position, ev->position,
             ev->state ? "down" : "up");
-    capture_event(eh);
+    if (capture_event(eh) != 0) {
+        return ZMK_EV_EVENT_BUBBLE;
+    }
     decide_hold_tap(undecided_hold_tap, ev->state ? HT_OTHER_KEY_DOWN : HT_OTHER_KEY_UP);
     return ZMK_EV_EVENT_CAPTURED;
 }
@@ -711,7 +921,9 @@ static int keycode_state_changed_listener(const zmk_event_t *eh) {
     // if a undecided_hold_tap is active.
     LOG_DBG("%d capturing 0x%02X %s event", undecided_hold_tap->position, ev->keycode,
             ev->state ? "down" : "up");
-    capture_event(eh);
+    if (capture_event(eh) != 0) {
+        return ZMK_EV_EVENT_BUBBLE;
+    }
     return ZMK_EV_EVENT_CAPTURED;
 }
 
@@ -729,14 +941,10 @@ ZMK_SUBSCRIPTION(behavior_hold_tap, zmk_position_state_changed);
 // this should be modifiers_state_changed, but unfrotunately that's not implemented yet.
 ZMK_SUBSCRIPTION(behavior_hold_tap, zmk_keycode_state_changed);
 
-void behavior_hold_tap_timer_work_handler(struct k_work *item) {
-    struct active_hold_tap *hold_tap = CONTAINER_OF(item, struct active_hold_tap, work);
+void behavior_hold_tap_timer_handler(struct zmk_timer *timer) {
+    struct active_hold_tap *hold_tap = CONTAINER_OF(timer, struct active_hold_tap, timer);
 
-    if (hold_tap->work_is_cancelled) {
-        clear_hold_tap(hold_tap);
-    } else {
-        decide_hold_tap(hold_tap, HT_TIMER_EVENT);
-    }
+    decide_hold_tap(hold_tap, HT_TIMER_EVENT);
 }
 
 static int behavior_hold_tap_init(const struct device *dev) {
@@ -744,8 +952,7 @@ static int behavior_hold_tap_init(const struct device *dev) {
 
     if (init_first_run) {
         for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_HELD; i++) {
-            k_work_init_delayable(&active_hold_taps[i].work, behavior_hold_tap_timer_work_handler);
-            active_hold_taps[i].position = ZMK_BHV_HOLD_TAP_POSITION_NOT_USED;
+            zmk_timer_init(&active_hold_taps[i].timer, behavior_hold_tap_timer_handler);
         }
     }
     init_first_run = false;
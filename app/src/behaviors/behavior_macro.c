@@ -37,70 +37,70 @@ struct behavior_macro_state {
     uint32_t press_bindings_count;
 };
 
+// What each binding of a macro does, resolved from the compatible of its behavior at build time.
+enum behavior_macro_op {
+    MACRO_OP_BINDING,
+    MACRO_OP_MODE_TAP,
+    MACRO_OP_MODE_PRESS,
+    MACRO_OP_MODE_RELEASE,
+    MACRO_OP_TAP_TIME,
+    MACRO_OP_WAIT_TIME,
+    MACRO_OP_PAUSE,
+    MACRO_OP_P1TO1,
+    MACRO_OP_P1TO2,
+    MACRO_OP_P2TO1,
+    MACRO_OP_P2TO2,
+};
+
 struct behavior_macro_config {
     uint32_t default_wait_ms;
     uint32_t default_tap_ms;
     uint32_t count;
+    const uint8_t *ops;
     struct zmk_behavior_binding bindings[];
 };
 
-#define TAP_MODE DT_PROP(DT_INST(0, zmk_macro_control_mode_tap), label)
-#define PRESS_MODE DT_PROP(DT_INST(0, zmk_macro_control_mode_press), label)
-#define REL_MODE DT_PROP(DT_INST(0, zmk_macro_control_mode_release), label)
-
-#define TAP_TIME DT_PROP(DT_INST(0, zmk_macro_control_tap_time), label)
-#define WAIT_TIME DT_PROP(DT_INST(0, zmk_macro_control_wait_time), label)
-#define WAIT_REL DT_PROP(DT_INST(0, zmk_macro_pause_for_release), label)
-
-#define P1TO1 DT_PROP(DT_INST(0, zmk_macro_param_1to1), label)
-#define P1TO2 DT_PROP(DT_INST(0, zmk_macro_param_1to2), label)
-#define P2TO1 DT_PROP(DT_INST(0, zmk_macro_param_2to1), label)
-#define P2TO2 DT_PROP(DT_INST(0, zmk_macro_param_2to2), label)
-
-#define ZM_IS_NODE_MATCH(a, b) (strcmp(a, b) == 0)
-#define IS_TAP_MODE(dev) ZM_IS_NODE_MATCH(dev, TAP_MODE)
-#define IS_PRESS_MODE(dev) ZM_IS_NODE_MATCH(dev, PRESS_MODE)
-#define IS_RELEASE_MODE(dev) ZM_IS_NODE_MATCH(dev, REL_MODE)
-
-#define IS_TAP_TIME(dev) ZM_IS_NODE_MATCH(dev, TAP_TIME)
-#define IS_WAIT_TIME(dev) ZM_IS_NODE_MATCH(dev, WAIT_TIME)
-#define IS_PAUSE(dev) ZM_IS_NODE_MATCH(dev, WAIT_REL)
-
-#define IS_P1TO1(dev) ZM_IS_NODE_MATCH(dev, P1TO1)
-#define IS_P1TO2(dev) ZM_IS_NODE_MATCH(dev, P1TO2)
-#define IS_P2TO1(dev) ZM_IS_NODE_MATCH(dev, P2TO1)
-#define IS_P2TO2(dev) ZM_IS_NODE_MATCH(dev, P2TO2)
-
 static bool handle_control_binding(struct behavior_macro_trigger_state *state,
+                                   enum behavior_macro_op op,
                                    const struct zmk_behavior_binding *binding) {
-    if (IS_TAP_MODE(binding->behavior_dev)) {
+    switch (op) {
+    case MACRO_OP_MODE_TAP:
         state->mode = MACRO_MODE_TAP;
         LOG_DBG("macro mode set: tap");
-    } else if (IS_PRESS_MODE(binding->behavior_dev)) {
+        break;
+    case MACRO_OP_MODE_PRESS:
         state->mode = MACRO_MODE_PRESS;
         LOG_DBG("macro mode set: press");
-    } else if (IS_RELEASE_MODE(binding->behavior_dev)) {
+        break;
+    case MACRO_OP_MODE_RELEASE:
         state->mode = MACRO_MODE_RELEASE;
         LOG_DBG("macro mode set: release");
-    } else if (IS_TAP_TIME(binding->behavior_dev)) {
+        break;
+    case MACRO_OP_TAP_TIME:
         state->tap_ms = binding->param1;
         LOG_DBG("macro tap time set: %d", state->tap_ms);
-    } else if (IS_WAIT_TIME(binding->behavior_dev)) {
+        break;
+    case MACRO_OP_WAIT_TIME:
         state->wait_ms = binding->param1;
         LOG_DBG("macro wait time set: %d", state->wait_ms);
-    } else if (IS_P1TO1(binding->behavior_dev)) {
+        break;
+    case MACRO_OP_P1TO1:
         state->param1_source = PARAM_SOURCE_MACRO_1ST;
         LOG_DBG("macro param: 1to1");
-    } else if (IS_P1TO2(binding->behavior_dev)) {
+        break;
+    case MACRO_OP_P1TO2:
         state->param2_source = PARAM_SOURCE_MACRO_1ST;
         LOG_DBG("macro param: 1to2");
-    } else if (IS_P2TO1(binding->behavior_dev)) {
+        break;
+    case MACRO_OP_P2TO1:
         state->param1_source = PARAM_SOURCE_MACRO_2ND;
         LOG_DBG("macro param: 2to1");
-    } else if (IS_P2TO2(binding->behavior_dev)) {
+        break;
+    case MACRO_OP_P2TO2:
         state->param2_source = PARAM_SOURCE_MACRO_2ND;
         LOG_DBG("macro param: 2to2");
-    } else {
+        break;
+    default:
         return false;
     }
 
@@ -116,9 +116,9 @@ static int behavior_macro_init(const struct device *dev) {
 
     LOG_DBG("Precalculate initial release state:");
     for (int i = 0; i < cfg->count; i++) {
-        if (handle_control_binding(&state->release_state, &cfg->bindings[i])) {
+        if (handle_control_binding(&state->release_state, cfg->ops[i], &cfg->bindings[i])) {
             // Updated state used for initial state on release.
-        } else if (IS_PAUSE(cfg->bindings[i].behavior_dev)) {
+        } else if (cfg->ops[i] == MACRO_OP_PAUSE) {
             state->release_state.start_index = i + 1;
             state->release_state.count = cfg->count - state->release_state.start_index;
             state->press_bindings_count = i;
@@ -132,54 +132,95 @@ static int behavior_macro_init(const struct device *dev) {
     return 0;
 };
 
+// A macro invocation stepping through its bindings in place while it runs in the behavior queue.
+struct behavior_macro_cursor {
+    const struct behavior_macro_config *config;
+    // start_index and count track the bindings that are left.
+    struct behavior_macro_trigger_state state;
+    uint32_t macro_param1;
+    uint32_t macro_param2;
+    // The current binding was pressed in tap mode and still has to be released.
+    bool tap_pressed;
+};
+
+BUILD_ASSERT(sizeof(struct behavior_macro_cursor) <= ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE,
+             "ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE is too small for macros");
+
 static uint32_t select_param(enum param_source param_source, uint32_t source_binding,
-                             const struct zmk_behavior_binding *macro_binding) {
+                             const struct behavior_macro_cursor *cursor) {
     switch (param_source) {
     case PARAM_SOURCE_MACRO_1ST:
-        return macro_binding->param1;
+        return cursor->macro_param1;
     case PARAM_SOURCE_MACRO_2ND:
-        return macro_binding->param2;
+        return cursor->macro_param2;
     default:
         return source_binding;
     }
 };
 
-static void replace_params(struct behavior_macro_trigger_state *state,
-                           struct zmk_behavior_binding *binding,
-                           const struct zmk_behavior_binding *macro_binding) {
-    binding->param1 = select_param(state->param1_source, binding->param1, macro_binding);
-    binding->param2 = select_param(state->param2_source, binding->param2, macro_binding);
+static void replace_params(struct behavior_macro_cursor *cursor,
+                           struct zmk_behavior_binding *binding) {
+    binding->param1 = select_param(cursor->state.param1_source, binding->param1, cursor);
+    binding->param2 = select_param(cursor->state.param2_source, binding->param2, cursor);
+}
+
+static bool macro_next(void *context, struct zmk_behavior_queue_step *step) {
+    struct behavior_macro_cursor *cursor = context;
+    struct behavior_macro_trigger_state *state = &cursor->state;
 
-    state->param1_source = PARAM_SOURCE_BINDING;
-    state->param2_source = PARAM_SOURCE_BINDING;
+    for (; state->count > 0; state->start_index++, state->count--) {
+        const struct zmk_behavior_binding *binding = &cursor->config->bindings[state->start_index];
+        if (!cursor->tap_pressed &&
+            handle_control_binding(state, cursor->config->ops[state->start_index], binding)) {
+            continue;
+        }
+
+        step->binding = *binding;
+        replace_params(cursor, &step->binding);
+
+        switch (state->mode) {
+        case MACRO_MODE_TAP:
+            if (!cursor->tap_pressed) {
+                // Keep the parameter sources until the release of this binding.
+                cursor->tap_pressed = true;
+                step->press = true;
+                step->wait = state->tap_ms;
+                return true;
+            }
+            cursor->tap_pressed = false;
+            step->press = false;
+            break;
+        case MACRO_MODE_PRESS:
+            step->press = true;
+            break;
+        case MACRO_MODE_RELEASE:
+            step->press = false;
+            break;
+        default:
+            LOG_ERR("Unknown macro mode: %d", state->mode);
+            continue;
+        }
+
+        step->wait = state->wait_ms;
+        state->param1_source = PARAM_SOURCE_BINDING;
+        state->param2_source = PARAM_SOURCE_BINDING;
+        state->start_index++;
+        state->count--;
+        return true;
+    }
+
+    return false;
 }
 
-static void queue_macro(uint32_t position, const struct zmk_behavior_binding bindings[],
+static void queue_macro(uint32_t position, const struct behavior_macro_config *cfg,
                         struct behavior_macro_trigger_state state,
                         const struct zmk_behavior_binding *macro_binding) {
     LOG_DBG("Iterating macro bindings - starting: %d, count: %d", state.start_index, state.count);
-    for (int i = state.start_index; i < state.start_index + state.count; i++) {
-        if (!handle_control_binding(&state, &bindings[i])) {
-            struct zmk_behavior_binding binding = bindings[i];
-            replace_params(&state, &binding, macro_binding);
-
-            switch (state.mode) {
-            case MACRO_MODE_TAP:
-                zmk_behavior_queue_add(position, binding, true, state.tap_ms);
-                zmk_behavior_queue_add(position, binding, false, state.wait_ms);
-                break;
-            case MACRO_MODE_PRESS:
-                zmk_behavior_queue_add(position, binding, true, state.wait_ms);
-                break;
-            case MACRO_MODE_RELEASE:
-                zmk_behavior_queue_add(position, binding, false, state.wait_ms);
-                break;
-            default:
-                LOG_ERR("Unknown macro mode: %d", state.mode);
-                break;
-            }
-        }
-    }
+    struct behavior_macro_cursor cursor = {.config = cfg,
+                                           .state = state,
+                                           .macro_param1 = macro_binding->param1,
+                                           .macro_param2 = macro_binding->param2};
+    zmk_behavior_queue_add_lane(position, macro_next, &cursor, sizeof(cursor));
 }
 
 static int on_macro_binding_pressed(struct zmk_behavior_binding *binding,
@@ -193,7 +234,7 @@ static int on_macro_binding_pressed(struct zmk_behavior_binding *binding,
                                                          .start_index = 0,
                                                          .count = state->press_bindings_count};
 
-    queue_macro(event.position, cfg->bindings, trigger_state, binding);
+    queue_macro(event.position, cfg, trigger_state, binding);
 
     return ZMK_BEHAVIOR_OPAQUE;
 }
@@ -204,7 +245,7 @@ static int on_macro_binding_released(struct zmk_behavior_binding *binding,
     const struct behavior_macro_config *cfg = dev->config;
     struct behavior_macro_state *state = dev->data;
 
-    queue_macro(event.position, cfg->bindings, state->release_state, binding);
+    queue_macro(event.position, cfg, state->release_state, binding);
 
     return ZMK_BEHAVIOR_OPAQUE;
 }
@@ -217,12 +258,30 @@ static const struct behavior_driver_api behavior_macro_driver_api = {
 #define TRANSFORMED_BEHAVIORS(n)                                                                   \
     {LISTIFY(DT_PROP_LEN(n, bindings), ZMK_KEYMAP_EXTRACT_BINDING, (, ), n)},
 
+#define MACRO_OP_IF(idx, n, compat, op)                                                            \
+    (DT_NODE_HAS_COMPAT(DT_PHANDLE_BY_IDX(n, bindings, idx), compat) * (op))
+
+#define MACRO_OP(idx, n)                                                                           \
+    (MACRO_OP_IF(idx, n, zmk_macro_control_mode_tap, MACRO_OP_MODE_TAP) +                          \
+     MACRO_OP_IF(idx, n, zmk_macro_control_mode_press, MACRO_OP_MODE_PRESS) +                      \
+     MACRO_OP_IF(idx, n, zmk_macro_control_mode_release, MACRO_OP_MODE_RELEASE) +                  \
+     MACRO_OP_IF(idx, n, zmk_macro_control_tap_time, MACRO_OP_TAP_TIME) +                          \
+     MACRO_OP_IF(idx, n, zmk_macro_control_wait_time, MACRO_OP_WAIT_TIME) +                        \
+     MACRO_OP_IF(idx, n, zmk_macro_pause_for_release, MACRO_OP_PAUSE) +                            \
+     MACRO_OP_IF(idx, n, zmk_macro_param_1to1, MACRO_OP_P1TO1) +                                   \
+     MACRO_OP_IF(idx, n, zmk_macro_param_1to2, MACRO_OP_P1TO2) +                                   \
+     MACRO_OP_IF(idx, n, zmk_macro_param_2to1, MACRO_OP_P2TO1) +                                   \
+     MACRO_OP_IF(idx, n, zmk_macro_param_2to2, MACRO_OP_P2TO2))
+
 #define MACRO_INST(inst)                                                                           \
+    static const uint8_t behavior_macro_ops_##inst[] = {                                           \
+        LISTIFY(DT_PROP_LEN(inst, bindings), MACRO_OP, (, ), inst)};                               \
     static struct behavior_macro_state behavior_macro_state_##inst = {};                           \
     static struct behavior_macro_config behavior_macro_config_##inst = {                           \
         .default_wait_ms = DT_PROP_OR(inst, wait_ms, CONFIG_ZMK_MACRO_DEFAULT_WAIT_MS),            \
         .default_tap_ms = DT_PROP_OR(inst, tap_ms, CONFIG_ZMK_MACRO_DEFAULT_TAP_MS),               \
         .count = DT_PROP_LEN(inst, bindings),                                                      \
+        .ops = behavior_macro_ops_##inst,                                                          \
         .bindings = TRANSFORMED_BEHAVIORS(inst)};                                                  \
     DEVICE_DT_DEFINE(inst, behavior_macro_init, NULL, &behavior_macro_state_##inst,                \
                      &behavior_macro_config_##inst, APPLICATION,                                   \
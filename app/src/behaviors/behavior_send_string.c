@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_behavior_send_string
+
+#include <zephyr/device.h>
+#include <drivers/behavior.h>
+#include <zephyr/logging/log.h>
+#include <zmk/behavior.h>
+#include <zmk/string_sender.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+struct behavior_send_string_config {
+    const char *text;
+};
+
+static int on_send_string_binding_pressed(struct zmk_behavior_binding *binding,
+                                          struct zmk_behavior_binding_event event) {
+    const struct device *dev = device_get_binding(binding->behavior_dev);
+    const struct behavior_send_string_config *config = dev->config;
+
+    zmk_string_sender_send(config->text);
+    return ZMK_BEHAVIOR_OPAQUE;
+}
+
+static int on_send_string_binding_released(struct zmk_behavior_binding *binding,
+                                           struct zmk_behavior_binding_event event) {
+    return ZMK_BEHAVIOR_OPAQUE;
+}
+
+static const struct behavior_driver_api behavior_send_string_driver_api = {
+    .binding_pressed = on_send_string_binding_pressed,
+    .binding_released = on_send_string_binding_released,
+};
+
+static int behavior_send_string_init(const struct device *dev) { return 0; }
+
+#define SS_INST(n)                                                                                 \
+    static const struct behavior_send_string_config behavior_send_string_config_##n = {           \
+        .text = DT_INST_PROP(n, text),                                                             \
+    };                                                                                             \
+    DEVICE_DT_INST_DEFINE(n, behavior_send_string_init, NULL, NULL,                                \
+                          &behavior_send_string_config_##n, APPLICATION,                           \
+                          CONFIG_KERNEL_INIT_PRIORITY_DEFAULT, &behavior_send_string_driver_api);
+
+DT_INST_FOREACH_STATUS_OKAY(SS_INST)
+
+#endif
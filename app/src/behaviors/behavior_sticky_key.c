@@ -19,6 +19,7 @@
 #include <zmk/events/modifiers_state_changed.h>
 #include <zmk/hid.h>
 #include <zmk/keymap.h>
+#include <zmk/timer_wheel.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
@@ -42,9 +43,8 @@ struct active_sticky_key {
     const struct behavior_sticky_key_config *config;
     // timer data.
     bool timer_started;
-    bool timer_cancelled;
     int64_t release_at;
-    struct k_work_delayable release_timer;
+    struct zmk_timer release_timer;
     // usage page and keycode for the key that is being modified by this sticky key
     uint8_t modified_key_usage_page;
     uint32_t modified_key_keycode;
@@ -57,8 +57,7 @@ static struct active_sticky_key *store_sticky_key(uint32_t position, uint32_t pa
                                                   const struct behavior_sticky_key_config *config) {
     for (int i = 0; i < ZMK_BHV_STICKY_KEY_MAX_HELD; i++) {
         struct active_sticky_key *const sticky_key = &active_sticky_keys[i];
-        if (sticky_key->position != ZMK_BHV_STICKY_KEY_POSITION_FREE ||
-            sticky_key->timer_cancelled) {
+        if (sticky_key->position != ZMK_BHV_STICKY_KEY_POSITION_FREE) {
             continue;
         }
         sticky_key->position = position;
@@ -66,7 +65,6 @@ static struct active_sticky_key *store_sticky_key(uint32_t position, uint32_t pa
         sticky_key->param2 = param2;
         sticky_key->config = config;
         sticky_key->release_at = 0;
-        sticky_key->timer_cancelled = false;
         sticky_key->timer_started = false;
         sticky_key->modified_key_usage_page = 0;
         sticky_key->modified_key_keycode = 0;
@@ -76,12 +74,13 @@ static struct active_sticky_key *store_sticky_key(uint32_t position, uint32_t pa
 }
 
 static void clear_sticky_key(struct active_sticky_key *sticky_key) {
+    zmk_timer_stop(&sticky_key->release_timer);
     sticky_key->position = ZMK_BHV_STICKY_KEY_POSITION_FREE;
 }
 
 static struct active_sticky_key *find_sticky_key(uint32_t position) {
     for (int i = 0; i < ZMK_BHV_STICKY_KEY_MAX_HELD; i++) {
-        if (active_sticky_keys[i].position == position && !active_sticky_keys[i].timer_cancelled) {
+        if (active_sticky_keys[i].position == position) {
             return &active_sticky_keys[i];
         }
     }
@@ -118,15 +117,6 @@ static inline int release_sticky_key_behavior(struct active_sticky_key *sticky_k
     return behavior_keymap_binding_released(&binding, event);
 }
 
-static int stop_timer(struct active_sticky_key *sticky_key) {
-    int timer_cancel_result = k_work_cancel_delayable(&sticky_key->release_timer);
-    if (timer_cancel_result == -EINPROGRESS) {
-        // too late to cancel, we'll let the timer handler clear up.
-        sticky_key->timer_cancelled = true;
-    }
-    return timer_cancel_result;
-}
-
 static int on_sticky_key_binding_pressed(struct zmk_behavior_binding *binding,
                                          struct zmk_behavior_binding_event event) {
     const struct device *dev = device_get_binding(binding->behavior_dev);
@@ -134,7 +124,7 @@ static int on_sticky_key_binding_pressed(struct zmk_behavior_binding *binding,
     struct active_sticky_key *sticky_key;
     sticky_key = find_sticky_key(event.position);
     if (sticky_key != NULL) {
-        stop_timer(sticky_key);
+        zmk_timer_stop(&sticky_key->release_timer);
         release_sticky_key_behavior(sticky_key, event.timestamp);
     }
     sticky_key = store_sticky_key(event.position, binding->param1, binding->param2, cfg);
@@ -166,9 +156,8 @@ static int on_sticky_key_binding_released(struct zmk_behavior_binding *binding,
     sticky_key->timer_started = true;
     sticky_key->release_at = event.timestamp + sticky_key->config->release_after_ms;
     // adjust timer in case this behavior was queued by a hold-tap
-    int32_t ms_left = sticky_key->release_at - k_uptime_get();
-    if (ms_left > 0) {
-        k_work_schedule(&sticky_key->release_timer, K_MSEC(ms_left));
+    if (sticky_key->release_at > k_uptime_get()) {
+        zmk_timer_start(&sticky_key->release_timer, sticky_key->release_at);
     }
     return ZMK_BEHAVIOR_OPAQUE;
 }
@@ -213,7 +202,7 @@ static int sticky_key_keycode_state_changed_listener(const zmk_event_t *eh) {
         // If this event was queued, the timer may be triggered late or not at all.
         // Release the sticky key if the timer should've run out in the meantime.
         if (sticky_key->release_at != 0 && ev_copy.timestamp > sticky_key->release_at) {
-            stop_timer(sticky_key);
+            zmk_timer_stop(&sticky_key->release_timer);
             release_sticky_key_behavior(sticky_key, sticky_key->release_at);
             continue;
         }
@@ -230,7 +219,7 @@ static int sticky_key_keycode_state_changed_listener(const zmk_event_t *eh) {
                 continue;
             }
             if (sticky_key->timer_started) {
-                stop_timer(sticky_key);
+                zmk_timer_stop(&sticky_key->release_timer);
                 if (sticky_key->config->quick_release) {
                     // immediately release the sticky key after the key press is handled.
                     if (!event_reraised) {
@@ -246,7 +235,7 @@ static int sticky_key_keycode_state_changed_listener(const zmk_event_t *eh) {
             if (sticky_key->timer_started &&
                 sticky_key->modified_key_usage_page == ev_copy.usage_page &&
                 sticky_key->modified_key_keycode == ev_copy.keycode) {
-                stop_timer(sticky_key);
+                zmk_timer_stop(&sticky_key->release_timer);
                 release_sticky_key_behavior(sticky_key, ev_copy.timestamp);
             }
         }
@@ -257,25 +246,20 @@ static int sticky_key_keycode_state_changed_listener(const zmk_event_t *eh) {
     return ZMK_EV_EVENT_BUBBLE;
 }
 
-void behavior_sticky_key_timer_handler(struct k_work *item) {
+void behavior_sticky_key_timer_handler(struct zmk_timer *timer) {
     struct active_sticky_key *sticky_key =
-        CONTAINER_OF(item, struct active_sticky_key, release_timer);
+        CONTAINER_OF(timer, struct active_sticky_key, release_timer);
     if (sticky_key->position == ZMK_BHV_STICKY_KEY_POSITION_FREE) {
         return;
     }
-    if (sticky_key->timer_cancelled) {
-        sticky_key->timer_cancelled = false;
-    } else {
-        release_sticky_key_behavior(sticky_key, sticky_key->release_at);
-    }
+    release_sticky_key_behavior(sticky_key, sticky_key->release_at);
 }
 
 static int behavior_sticky_key_init(const struct device *dev) {
     static bool init_first_run = true;
     if (init_first_run) {
         for (int i = 0; i < ZMK_BHV_STICKY_KEY_MAX_HELD; i++) {
-            k_work_init_delayable(&active_sticky_keys[i].release_timer,
-                                  behavior_sticky_key_timer_handler);
+            zmk_timer_init(&active_sticky_keys[i].release_timer, behavior_sticky_key_timer_handler);
             active_sticky_keys[i].position = ZMK_BHV_STICKY_KEY_POSITION_FREE;
         }
     }
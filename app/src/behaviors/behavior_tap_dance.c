@@ -16,6 +16,7 @@
 #include <zmk/events/position_state_changed.h>
 #include <zmk/events/keycode_state_changed.h>
 #include <zmk/hid.h>
+#include <zmk/timer_wheel.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
@@ -42,17 +43,16 @@ struct active_tap_dance {
 
     // Timer Data
     bool timer_started;
-    bool timer_cancelled;
     bool tap_dance_decided;
     int64_t release_at;
-    struct k_work_delayable release_timer;
+    struct zmk_timer release_timer;
 };
 
 struct active_tap_dance active_tap_dances[ZMK_BHV_TAP_DANCE_MAX_HELD] = {};
 
 static struct active_tap_dance *find_tap_dance(uint32_t position) {
     for (int i = 0; i < ZMK_BHV_TAP_DANCE_MAX_HELD; i++) {
-        if (active_tap_dances[i].position == position && !active_tap_dances[i].timer_cancelled) {
+        if (active_tap_dances[i].position == position) {
             return &active_tap_dances[i];
         }
     }
@@ -70,7 +70,6 @@ static int new_tap_dance(uint32_t position, const struct behavior_tap_dance_conf
             ref_dance->release_at = 0;
             ref_dance->is_pressed = true;
             ref_dance->timer_started = true;
-            ref_dance->timer_cancelled = false;
             ref_dance->tap_dance_decided = false;
             *tap_dance = ref_dance;
             return 0;
@@ -80,24 +79,15 @@ static int new_tap_dance(uint32_t position, const struct behavior_tap_dance_conf
 }
 
 static void clear_tap_dance(struct active_tap_dance *tap_dance) {
+    zmk_timer_stop(&tap_dance->release_timer);
     tap_dance->position = ZMK_BHV_TAP_DANCE_POSITION_FREE;
 }
 
-static int stop_timer(struct active_tap_dance *tap_dance) {
-    int timer_cancel_result = k_work_cancel_delayable(&tap_dance->release_timer);
-    if (timer_cancel_result == -EINPROGRESS) {
-        // too late to cancel, we'll let the timer handler clear up.
-        tap_dance->timer_cancelled = true;
-    }
-    return timer_cancel_result;
-}
-
 static void reset_timer(struct active_tap_dance *tap_dance,
                         struct zmk_behavior_binding_event event) {
     tap_dance->release_at = event.timestamp + tap_dance->config->tapping_term_ms;
-    int32_t ms_left = tap_dance->release_at - k_uptime_get();
-    if (ms_left > 0) {
-        k_work_schedule(&tap_dance->release_timer, K_MSEC(ms_left));
+    if (tap_dance->release_at > k_uptime_get()) {
+        zmk_timer_start(&tap_dance->release_timer, tap_dance->release_at);
         LOG_DBG("Successfully reset timer at position %d", tap_dance->position);
     }
 }
@@ -138,7 +128,7 @@ static int on_tap_dance_binding_pressed(struct zmk_behavior_binding *binding,
     }
     tap_dance->is_pressed = true;
     LOG_DBG("%d tap dance pressed", event.position);
-    stop_timer(tap_dance);
+    zmk_timer_stop(&tap_dance->release_timer);
     // Increment the counter on keypress. If the counter has reached its maximum
     // value, invoke the last binding available.
     if (tap_dance->counter < cfg->behavior_count) {
@@ -168,14 +158,12 @@ static int on_tap_dance_binding_released(struct zmk_behavior_binding *binding,
     return ZMK_BEHAVIOR_OPAQUE;
 }
 
-void behavior_tap_dance_timer_handler(struct k_work *item) {
-    struct active_tap_dance *tap_dance = CONTAINER_OF(item, struct active_tap_dance, release_timer);
+void behavior_tap_dance_timer_handler(struct zmk_timer *timer) {
+    struct active_tap_dance *tap_dance =
+        CONTAINER_OF(timer, struct active_tap_dance, release_timer);
     if (tap_dance->position == ZMK_BHV_TAP_DANCE_POSITION_FREE) {
         return;
     }
-    if (tap_dance->timer_cancelled) {
-        return;
-    }
     LOG_DBG("Tap dance has been decided via timer. Counter reached: %d", tap_dance->counter);
     press_tap_dance_behavior(tap_dance, tap_dance->release_at);
     if (tap_dance->is_pressed) {
@@ -211,7 +199,7 @@ static int tap_dance_position_state_changed_listener(const zmk_event_t *eh) {
         if (tap_dance->position == ev->position) {
             continue;
         }
-        stop_timer(tap_dance);
+        zmk_timer_stop(&tap_dance->release_timer);
         LOG_DBG("Tap dance interrupted, activating tap-dance at %d", tap_dance->position);
         if (!tap_dance->tap_dance_decided) {
             press_tap_dance_behavior(tap_dance, ev->timestamp);
@@ -228,8 +216,7 @@ static int behavior_tap_dance_init(const struct device *dev) {
     static bool init_first_run = true;
     if (init_first_run) {
         for (int i = 0; i < ZMK_BHV_TAP_DANCE_MAX_HELD; i++) {
-            k_work_init_delayable(&active_tap_dances[i].release_timer,
-                                  behavior_tap_dance_timer_handler);
+            zmk_timer_init(&active_tap_dances[i].release_timer, behavior_tap_dance_timer_handler);
             clear_tap_dance(&active_tap_dances[i]);
         }
     }
@@ -17,6 +17,7 @@
 #include <zmk/events/position_state_changed.h>
 #include <zmk/events/layer_state_changed.h>
 #include <zmk/hid.h>
+#include <zmk/timer_wheel.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
@@ -40,38 +41,27 @@ struct active_tri_state {
     bool first_press;
     uint32_t position;
     const struct behavior_tri_state_config *config;
-    struct k_work_delayable release_timer;
+    struct zmk_timer release_timer;
     int64_t release_at;
     bool timer_started;
-    bool timer_cancelled;
 };
 
-static int stop_timer(struct active_tri_state *tri_state) {
-    int timer_cancel_result = k_work_cancel_delayable(&tri_state->release_timer);
-    if (timer_cancel_result == -EINPROGRESS) {
-        // too late to cancel, we'll let the timer handler clear up.
-        tri_state->timer_cancelled = true;
-    }
-    return timer_cancel_result;
-}
-
 static void reset_timer(int32_t timestamp, struct active_tri_state *tri_state) {
     tri_state->release_at = timestamp + tri_state->config->timeout_ms;
-    int32_t ms_left = tri_state->release_at - k_uptime_get();
-    if (ms_left > 0) {
-        k_work_schedule(&tri_state->release_timer, K_MSEC(ms_left));
+    if (tri_state->release_at > k_uptime_get()) {
+        zmk_timer_start(&tri_state->release_timer, tri_state->release_at);
         LOG_DBG("Successfully reset tri-state timer");
     }
 }
 
 void trigger_end_behavior(struct active_tri_state *si) {
-    zmk_behavior_queue_add(si->position, si->config->end_behavior, true, si->config->tap_ms);
-    zmk_behavior_queue_add(si->position, si->config->end_behavior, false, 0);
+    zmk_behavior_queue_add_taps(si->position, si->config->end_behavior, si->config->tap_ms, 1);
 }
 
-void behavior_tri_state_timer_handler(struct k_work *item) {
-    struct active_tri_state *tri_state = CONTAINER_OF(item, struct active_tri_state, release_timer);
-    if (!tri_state->is_active || tri_state->timer_cancelled || tri_state->is_pressed) {
+void behavior_tri_state_timer_handler(struct zmk_timer *timer) {
+    struct active_tri_state *tri_state =
+        CONTAINER_OF(timer, struct active_tri_state, release_timer);
+    if (!tri_state->is_active || tri_state->is_pressed) {
         return;
     }
     LOG_DBG("Tri-state deactivated due to timer");
@@ -175,8 +165,7 @@ static int behavior_tri_state_init(const struct device *dev) {
     static bool init_first_run = true;
     if (init_first_run) {
         for (int i = 0; i < ZMK_BHV_MAX_ACTIVE_TRI_STATES; i++) {
-            k_work_init_delayable(&active_tri_states[i].release_timer,
-                                  behavior_tri_state_timer_handler);
+            zmk_timer_init(&active_tri_states[i].release_timer, behavior_tri_state_timer_handler);
             clear_tri_state(&active_tri_states[i]);
         }
     }
@@ -232,7 +221,7 @@ static int tri_state_position_state_changed_listener(const zmk_event_t *eh) {
             return ZMK_EV_EVENT_BUBBLE;
         }
         if (ev->state) {
-            stop_timer(tri_state);
+            zmk_timer_stop(&tri_state->release_timer);
         } else {
             reset_timer(ev->timestamp, tri_state);
         }
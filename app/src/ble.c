@@ -6,6 +6,7 @@
 
 #include <zephyr/device.h>
 #include <zephyr/init.h>
+#include <zephyr/spinlock.h>
 
 #include <errno.h>
 #include <math.h>
@@ -82,6 +83,58 @@ static bt_addr_le_t peripheral_addrs[ZMK_SPLIT_BLE_PERIPHERAL_COUNT];
 
 #endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL) */
 
+// Connection to the host of the active profile, kept up to date so sending a report doesn't have to
+// look it up. Updated from the BT RX thread and the system work queue, and read from the HOG work
+// queue.
+static struct bt_conn *active_profile_conn;
+static struct k_spinlock active_profile_conn_lock;
+
+static void set_active_profile_conn(struct bt_conn *conn) {
+    if (conn != NULL) {
+        conn = bt_conn_ref(conn);
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&active_profile_conn_lock);
+    struct bt_conn *old = active_profile_conn;
+    active_profile_conn = conn;
+    k_spin_unlock(&active_profile_conn_lock, key);
+
+    if (old != NULL) {
+        bt_conn_unref(old);
+    }
+}
+
+static void update_active_profile_conn() {
+    struct bt_conn *conn = NULL;
+    bt_addr_le_t *addr = zmk_ble_active_profile_addr();
+
+    if (bt_addr_le_cmp(addr, BT_ADDR_LE_ANY)) {
+        conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+    }
+
+    if (conn != NULL) {
+        struct bt_conn_info info;
+        bt_conn_get_info(conn, &info);
+        if (info.state != BT_CONN_STATE_CONNECTED) {
+            bt_conn_unref(conn);
+            conn = NULL;
+        }
+    }
+
+    set_active_profile_conn(conn);
+
+    if (conn != NULL) {
+        bt_conn_unref(conn);
+    }
+}
+
+struct bt_conn *zmk_ble_active_profile_conn() {
+    k_spinlock_key_t key = k_spin_lock(&active_profile_conn_lock);
+    struct bt_conn *conn = active_profile_conn != NULL ? bt_conn_ref(active_profile_conn) : NULL;
+    k_spin_unlock(&active_profile_conn_lock, key);
+    return conn;
+}
+
 static void raise_profile_changed_event() {
     ZMK_EVENT_RAISE(new_zmk_ble_active_profile_changed((struct zmk_ble_active_profile_changed){
         .index = active_profile, .profile = &profiles[active_profile]}));
@@ -107,6 +160,9 @@ void set_profile_address(uint8_t index, const bt_addr_le_t *addr) {
     sprintf(setting_name, "ble/profiles/%d", index);
     LOG_DBG("Setting profile addr for %s to %s", setting_name, addr_str);
     settings_save_one(setting_name, &profiles[index], sizeof(struct zmk_ble_profile));
+    if (index == active_profile) {
+        update_active_profile_conn();
+    }
     k_work_submit(&raise_profile_changed_event_work);
 }
 
@@ -224,6 +280,15 @@ int zmk_ble_clear_bonds() {
 
 int zmk_ble_active_profile_index() { return active_profile; }
 
+int zmk_ble_profile_index(const bt_addr_le_t *addr) {
+    for (int i = 0; i < ZMK_BLE_PROFILE_COUNT; i++) {
+        if (bt_addr_le_cmp(addr, &profiles[i].peer) == 0) {
+            return i;
+        }
+    }
+    return -ENODEV;
+}
+
 #if IS_ENABLED(CONFIG_SETTINGS)
 static void ble_save_profile_work(struct k_work *work) {
     settings_save_one("ble/active_profile", &active_profile, sizeof(active_profile));
@@ -252,6 +317,7 @@ int zmk_ble_prof_select(uint8_t index) {
 
     active_profile = index;
     ble_save_profile();
+    update_active_profile_conn();
 
     update_advertising();
 
@@ -423,6 +489,7 @@ static void connected(struct bt_conn *conn, uint8_t err) {
 
     if (is_conn_active_profile(conn)) {
         LOG_DBG("Active profile connected");
+        set_active_profile_conn(conn);
         k_work_submit(&raise_profile_changed_event_work);
     }
 }
@@ -448,6 +515,7 @@ static void disconnected(struct bt_conn *conn, uint8_t reason) {
 
     if (is_conn_active_profile(conn)) {
         LOG_DBG("Active profile disconnected");
+        set_active_profile_conn(NULL);
         k_work_submit(&raise_profile_changed_event_work);
     }
 }
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/activity.h>
+#include <zmk/ble.h>
+#include <zmk/ble/conn_params.h>
+#include <zmk/event_manager.h>
+#include <zmk/events/activity_state_changed.h>
+#include <zmk/events/ble_active_profile_changed.h>
+
+// The active profile's connection uses a short interval without peripheral latency while the
+// keyboard is in use, and every other connection, as well as the active one once the keyboard has
+// gone idle, relaxes to a long interval with high latency to save power.
+
+static const struct bt_le_conn_param active_params = BT_LE_CONN_PARAM_INIT(
+    CONFIG_ZMK_BLE_CONN_PARAMS_ACTIVE_INTERVAL, CONFIG_ZMK_BLE_CONN_PARAMS_ACTIVE_INTERVAL,
+    CONFIG_ZMK_BLE_CONN_PARAMS_ACTIVE_LATENCY, CONFIG_BT_PERIPHERAL_PREF_TIMEOUT);
+
+static const struct bt_le_conn_param idle_params = BT_LE_CONN_PARAM_INIT(
+    CONFIG_ZMK_BLE_CONN_PARAMS_IDLE_MIN_INTERVAL, CONFIG_ZMK_BLE_CONN_PARAMS_IDLE_MAX_INTERVAL,
+    CONFIG_ZMK_BLE_CONN_PARAMS_IDLE_LATENCY, CONFIG_BT_PERIPHERAL_PREF_TIMEOUT);
+
+static struct zmk_ble_conn_params_stats stats[ZMK_BLE_PROFILE_COUNT];
+
+// Whether parameters have been requested on the current connection of the profile, and whether
+// the host has yet to update the connection in response.
+static bool requested[ZMK_BLE_PROFILE_COUNT];
+static bool pending[ZMK_BLE_PROFILE_COUNT];
+
+static bool active = true;
+static int64_t active_since;
+
+static bool params_equal(const struct bt_le_conn_param *a, const struct bt_le_conn_param *b) {
+    return a->interval_min == b->interval_min && a->interval_max == b->interval_max &&
+           a->latency == b->latency && a->timeout == b->timeout;
+}
+
+static int conn_profile(struct bt_conn *conn) {
+    struct bt_conn_info info;
+
+    bt_conn_get_info(conn, &info);
+    if (info.role != BT_CONN_ROLE_PERIPHERAL || info.state != BT_CONN_STATE_CONNECTED) {
+        return -ENODEV;
+    }
+
+    return zmk_ble_profile_index(bt_conn_get_dst(conn));
+}
+
+static void apply_conn_params(struct bt_conn *conn, void *data) {
+    int profile = conn_profile(conn);
+    if (profile < 0) {
+        return;
+    }
+
+    const struct bt_le_conn_param *params =
+        active && profile == zmk_ble_active_profile_index() ? &active_params : &idle_params;
+    struct zmk_ble_conn_params_stats *profile_stats = &stats[profile];
+
+    if (requested[profile] && params_equal(&profile_stats->requested, params)) {
+        return;
+    }
+
+    LOG_DBG("Requesting interval %d-%d latency %d for profile %d", params->interval_min,
+            params->interval_max, params->latency, profile);
+
+    int err = bt_conn_le_param_update(conn, params);
+    if (err) {
+        LOG_WRN("Failed to request connection parameters for profile %d (%d)", profile, err);
+        return;
+    }
+
+    profile_stats->requested = *params;
+    profile_stats->requests++;
+    requested[profile] = true;
+    pending[profile] = true;
+}
+
+static void apply_work_handler(struct k_work *work) {
+    bt_conn_foreach(BT_CONN_TYPE_LE, apply_conn_params, NULL);
+}
+
+static K_WORK_DEFINE(apply_work, apply_work_handler);
+
+static void relax_work_handler(struct k_work *work) {
+    active = false;
+    apply_work_handler(NULL);
+}
+
+static K_WORK_DELAYABLE_DEFINE(relax_work, relax_work_handler);
+
+static void connected(struct bt_conn *conn, uint8_t err) {
+    if (err) {
+        return;
+    }
+
+    int profile = conn_profile(conn);
+    if (profile < 0) {
+        return;
+    }
+
+    struct bt_conn_info info;
+    bt_conn_get_info(conn, &info);
+
+    // A new connection starts out with whatever the host picked.
+    requested[profile] = false;
+    pending[profile] = false;
+    stats[profile].interval = info.le.interval;
+    stats[profile].latency = info.le.latency;
+    stats[profile].timeout = info.le.timeout;
+
+    k_work_submit(&apply_work);
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency,
+                             uint16_t timeout) {
+    int profile = conn_profile(conn);
+    if (profile < 0) {
+        return;
+    }
+
+    struct zmk_ble_conn_params_stats *profile_stats = &stats[profile];
+
+    profile_stats->interval = interval;
+    profile_stats->latency = latency;
+    profile_stats->timeout = timeout;
+
+    if (!pending[profile]) {
+        return;
+    }
+    pending[profile] = false;
+
+    if (interval >= profile_stats->requested.interval_min &&
+        interval <= profile_stats->requested.interval_max &&
+        latency == profile_stats->requested.latency) {
+        profile_stats->accepted++;
+    } else {
+        LOG_DBG("Host of profile %d picked interval %d latency %d instead", profile, interval,
+                latency);
+        profile_stats->rejected++;
+    }
+}
+
+static struct bt_conn_cb conn_callbacks = {
+    .connected = connected,
+    .le_param_updated = le_param_updated,
+};
+
+const struct zmk_ble_conn_params_stats *zmk_ble_conn_params_get_stats(uint8_t profile) {
+    if (profile >= ZMK_BLE_PROFILE_COUNT) {
+        return NULL;
+    }
+    return &stats[profile];
+}
+
+static int conn_params_listener(const zmk_event_t *eh) {
+    const struct zmk_activity_state_changed *ev = as_zmk_activity_state_changed(eh);
+    if (ev == NULL) {
+        // The active profile changed, so its connection now gets the active parameters and the
+        // previous one relaxes.
+        k_work_submit(&apply_work);
+        return ZMK_EV_EVENT_BUBBLE;
+    }
+
+    if (ev->state == ZMK_ACTIVITY_ACTIVE) {
+        k_work_cancel_delayable(&relax_work);
+        if (!active) {
+            active = true;
+            active_since = k_uptime_get();
+            k_work_submit(&apply_work);
+        }
+    } else {
+        // Stay fast for a while after becoming active, so short bursts of activity don't flip the
+        // parameters back and forth.
+        int64_t relax_at = active_since + CONFIG_ZMK_BLE_CONN_PARAMS_MIN_ACTIVE_MS;
+        k_work_reschedule(&relax_work, K_MSEC(MAX(relax_at - k_uptime_get(), 0)));
+    }
+
+    return ZMK_EV_EVENT_BUBBLE;
+}
+
+ZMK_LISTENER(ble_conn_params, conn_params_listener);
+ZMK_SUBSCRIPTION(ble_conn_params, zmk_activity_state_changed);
+ZMK_SUBSCRIPTION(ble_conn_params, zmk_ble_active_profile_changed);
+
+static int ble_conn_params_init(const struct device *_arg) {
+    active = zmk_activity_get_state() == ZMK_ACTIVITY_ACTIVE;
+    active_since = k_uptime_get();
+    bt_conn_cb_register(&conn_callbacks);
+    return 0;
+}
+
+SYS_INIT(ble_conn_params_init, APPLICATION, CONFIG_ZMK_BLE_INIT_PRIORITY);
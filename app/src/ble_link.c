@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/event_manager.h>
+#include <zmk/events/ble_link_updated.h>
+
+// Zephyr's automatic PHY and data length updates switch every new connection, to a host or to
+// another split half, to the 2M PHY and the longest data packets both sides support. This only
+// reports the resulting link parameters to the rest of ZMK.
+
+K_MSGQ_DEFINE(link_updated_msgq, sizeof(struct zmk_ble_link_updated), 4, 4);
+
+static void link_updated_work_callback(struct k_work *work) {
+    struct zmk_ble_link_updated ev;
+    while (k_msgq_get(&link_updated_msgq, &ev, K_NO_WAIT) == 0) {
+        ZMK_EVENT_RAISE(new_zmk_ble_link_updated(ev));
+    }
+}
+
+static K_WORK_DEFINE(link_updated_work, link_updated_work_callback);
+
+static void raise_link_updated(struct bt_conn *conn) {
+    struct bt_conn_info info;
+    struct zmk_ble_link_updated ev = {
+        .tx_phy = BT_GAP_LE_PHY_1M,
+        .rx_phy = BT_GAP_LE_PHY_1M,
+        .tx_max_len = BT_GAP_DATA_LEN_DEFAULT,
+        .rx_max_len = BT_GAP_DATA_LEN_DEFAULT,
+    };
+
+    if (bt_conn_get_info(conn, &info)) {
+        return;
+    }
+
+    bt_addr_le_copy(&ev.addr, bt_conn_get_dst(conn));
+
+#if IS_ENABLED(CONFIG_BT_USER_PHY_UPDATE)
+    ev.tx_phy = info.le.phy->tx_phy;
+    ev.rx_phy = info.le.phy->rx_phy;
+#endif
+
+#if IS_ENABLED(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    ev.tx_max_len = info.le.data_len->tx_max_len;
+    ev.rx_max_len = info.le.data_len->rx_max_len;
+#endif
+
+    if (k_msgq_put(&link_updated_msgq, &ev, K_NO_WAIT)) {
+        LOG_WRN("Link update event queue full, dropping event");
+        return;
+    }
+    k_work_submit(&link_updated_work);
+}
+
+#if IS_ENABLED(CONFIG_BT_USER_PHY_UPDATE)
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param) {
+    LOG_DBG("PHY updated to tx %d rx %d", param->tx_phy, param->rx_phy);
+    raise_link_updated(conn);
+}
+#endif
+
+#if IS_ENABLED(CONFIG_BT_USER_DATA_LEN_UPDATE)
+static void le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info) {
+    LOG_DBG("Data length updated to tx %d rx %d", info->tx_max_len, info->rx_max_len);
+    raise_link_updated(conn);
+}
+#endif
+
+static struct bt_conn_cb conn_callbacks = {
+#if IS_ENABLED(CONFIG_BT_USER_PHY_UPDATE)
+    .le_phy_updated = le_phy_updated,
+#endif
+#if IS_ENABLED(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    .le_data_len_updated = le_data_len_updated,
+#endif
+};
+
+static int ble_link_init(const struct device *_arg) {
+    bt_conn_cb_register(&conn_callbacks);
+    return 0;
+}
+
+SYS_INIT(ble_link_init, APPLICATION, CONFIG_ZMK_BLE_INIT_PRIORITY);
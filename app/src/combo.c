@@ -8,76 +8,92 @@
 
 #include <zephyr/device.h>
 #include <zephyr/logging/log.h>
-#include <zephyr/sys/dlist.h>
 #include <zephyr/kernel.h>
 
 #include <drivers/behavior.h>
 
 #include <zmk/behavior.h>
+#include <zmk/combo_engine.h>
 #include <zmk/event_manager.h>
 #include <zmk/events/position_state_changed.h>
 #include <zmk/events/keycode_state_changed.h>
+#include <zmk/events/layer_state_changed.h>
 #include <zmk/hid.h>
 #include <zmk/matrix.h>
 #include <zmk/keymap.h>
+#include <zmk/timer_wheel.h>
 #include <zmk/virtual_key_position.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
 
-struct combo_cfg {
-    int32_t key_positions[CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO];
-    int32_t key_position_len;
-    struct zmk_behavior_binding behavior;
-    int32_t timeout_ms;
-    int32_t require_prior_idle_ms;
-    // if slow release is set, the combo releases when the last key is released.
-    // otherwise, the combo releases when the first key is released.
-    bool slow_release;
-    // the virtual key position is a key position outside the range used by the keyboard.
-    // it is necessary so hold-taps can uniquely identify a behavior.
-    int32_t virtual_key_position;
-    int32_t layers_len;
-    int8_t layers[];
-};
-
 struct active_combo {
-    struct combo_cfg *combo;
-    // key_positions_pressed is filled with key_positions when the combo is pressed.
-    // The keys are removed from this array when they are released.
-    // Once this array is empty, the behavior is released.
-    const zmk_event_t *key_positions_pressed[CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO];
+    const struct combo_cfg *combo;
+    // the key positions of the combo
+    struct zmk_combo_position_mask keys;
+    // the positions of the combo that are still held. Once this is empty,
+    // the combo is deactivated.
+    struct zmk_combo_position_mask held;
 };
 
-struct combo_candidate {
-    struct combo_cfg *combo;
-    // the time after which this behavior should be removed from candidates.
-    // by keeping track of when the candidate should be cleared there is no
-    // possibility of accidental releases.
-    int64_t timeout_at;
-};
+#define COMBO_POSITIONS(n) static const int32_t combo_positions_##n[] = DT_PROP(n, key_positions);
+
+DT_INST_FOREACH_CHILD(0, COMBO_POSITIONS)
+
+// layers are limited to the width of zmk_keymap_layers_state_t.
+#define COMBO_LAYERS_MAX ((int)(8 * sizeof(zmk_keymap_layers_state_t)))
+
+#define COMBO_LAYER_CHECK(node_id, prop, idx)                                                      \
+    BUILD_ASSERT(DT_PROP_BY_IDX(node_id, prop, idx) < COMBO_LAYERS_MAX,                            \
+                 "Combo layers must be lower than the number of supported layers");
+#define COMBO_LAYERS_CHECK(n) DT_FOREACH_PROP_ELEM(n, layers, COMBO_LAYER_CHECK)
+
+DT_INST_FOREACH_CHILD(0, COMBO_LAYERS_CHECK)
+
+// the index is masked so the -1 global marker does not produce a negative shift; it is handled by
+// COMBO_LAYER_MASK. Larger layers are rejected above.
+#define COMBO_LAYER_BIT(node_id, prop, idx)                                                        \
+    BIT(DT_PROP_BY_IDX(node_id, prop, idx) & (COMBO_LAYERS_MAX - 1)) |
+
+// -1 in the first layer position is global layer scope
+#define COMBO_LAYER_MASK(n)                                                                        \
+    ((DT_PROP_BY_IDX(n, layers, 0) == -1) ? ~(zmk_keymap_layers_state_t)0                          \
+                                          : (DT_FOREACH_PROP_ELEM(n, layers, COMBO_LAYER_BIT) 0))
+
+#define COMBO_INST(n)                                                                              \
+    {                                                                                              \
+        .timeout_ms = DT_PROP(n, timeout_ms),                                                      \
+        .require_prior_idle_ms = DT_PROP(n, require_prior_idle_ms),                                \
+        .key_positions = combo_positions_##n,                                                      \
+        .key_position_len = DT_PROP_LEN(n, key_positions),                                         \
+        .behavior = ZMK_KEYMAP_EXTRACT_BINDING(0, n),                                              \
+        .virtual_key_position = ZMK_VIRTUAL_KEY_POSITION_COMBO(__COUNTER__),                       \
+        .slow_release = DT_PROP(n, slow_release),                                                  \
+        .layer_mask = COMBO_LAYER_MASK(n),                                                         \
+    },
+
+static const struct combo_cfg combos[] = {DT_INST_FOREACH_CHILD(0, COMBO_INST)};
 
-// set of keys pressed
-const zmk_event_t *pressed_keys[CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO] = {NULL};
-// the set of candidate combos based on the currently pressed_keys
-struct combo_candidate candidates[CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY];
+// captured key events, in the order they were pressed
+static const zmk_event_t *pressed_keys[ZMK_COMBO_PRESSED_KEYS_MAX] = {NULL};
+// the positions of the captured key events
+static struct zmk_combo_position_mask pressed_mask;
 // the last candidate that was completely pressed
-struct combo_cfg *fully_pressed_combo = NULL;
-// a lookup dict that maps a key position to all combos on that position
-struct combo_cfg *combo_lookup[ZMK_KEYMAP_LEN][CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY] = {NULL};
+static const struct combo_cfg *fully_pressed_combo = NULL;
 // combos that have been activated and still have (some) keys pressed
 // this array is always contiguous from 0.
-struct active_combo active_combos[CONFIG_ZMK_COMBO_MAX_PRESSED_COMBOS] = {NULL};
-int active_combo_count = 0;
+static struct active_combo active_combos[CONFIG_ZMK_COMBO_MAX_PRESSED_COMBOS] = {NULL};
+static int active_combo_count = 0;
+// the key events held by active combos, indexed by key position
+static const zmk_event_t *active_combo_events[ZMK_KEYMAP_LEN] = {NULL};
 
-struct k_work_delayable timeout_task;
-int64_t timeout_task_timeout_at;
+static struct zmk_timer timeout_task;
 
 // this keeps track of the last non-combo, non-mod key tap
-int64_t last_tapped_timestamp = INT32_MIN;
+static int64_t last_tapped_timestamp = INT32_MIN;
 // this keeps track of the last time a combo was pressed
-int64_t last_combo_timestamp = INT32_MIN;
+static int64_t last_combo_timestamp = INT32_MIN;
 
 static void store_last_tapped(int64_t timestamp) {
     if (timestamp > last_combo_timestamp) {
@@ -85,188 +101,28 @@ static void store_last_tapped(int64_t timestamp) {
     }
 }
 
-// Store the combo key pointer in the combos array, one pointer for each key position
-// The combos are sorted shortest-first, then by virtual-key-position.
-static int initialize_combo(struct combo_cfg *new_combo) {
-    for (int i = 0; i < new_combo->key_position_len; i++) {
-        int32_t position = new_combo->key_positions[i];
-        if (position >= ZMK_KEYMAP_LEN) {
-            LOG_ERR("Unable to initialize combo, key position %d does not exist", position);
-            return -EINVAL;
-        }
-
-        struct combo_cfg *insert_combo = new_combo;
-        bool set = false;
-        for (int j = 0; j < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; j++) {
-            struct combo_cfg *combo_at_j = combo_lookup[position][j];
-            if (combo_at_j == NULL) {
-                combo_lookup[position][j] = insert_combo;
-                set = true;
-                break;
-            }
-            if (combo_at_j->key_position_len < insert_combo->key_position_len ||
-                (combo_at_j->key_position_len == insert_combo->key_position_len &&
-                 combo_at_j->virtual_key_position < insert_combo->virtual_key_position)) {
-                continue;
-            }
-            // put insert_combo in this spot, move all other combos up.
-            combo_lookup[position][j] = insert_combo;
-            insert_combo = combo_at_j;
-        }
-        if (!set) {
-            LOG_ERR("Too many combos for key position %d, CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY %d.",
-                    position, CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY);
-            return -ENOMEM;
-        }
-    }
-    return 0;
-}
-
-static bool combo_active_on_layer(struct combo_cfg *combo, uint8_t layer) {
-    if (combo->layers[0] == -1) {
-        // -1 in the first layer position is global layer scope
-        return true;
-    }
-    for (int j = 0; j < combo->layers_len; j++) {
-        if (combo->layers[j] == layer) {
-            return true;
-        }
-    }
-    return false;
-}
-
-static bool is_quick_tap(struct combo_cfg *combo, int64_t timestamp) {
+bool zmk_combo_is_quick_tap(const struct combo_cfg *combo, int64_t timestamp) {
     return (last_tapped_timestamp + combo->require_prior_idle_ms) > timestamp;
 }
 
-static int setup_candidates_for_first_keypress(int32_t position, int64_t timestamp) {
-    int number_of_combo_candidates = 0;
-    uint8_t highest_active_layer = zmk_keymap_highest_layer_active();
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        struct combo_cfg *combo = combo_lookup[position][i];
-        if (combo == NULL) {
-            return number_of_combo_candidates;
-        }
-        if (combo_active_on_layer(combo, highest_active_layer) && !is_quick_tap(combo, timestamp)) {
-            candidates[number_of_combo_candidates].combo = combo;
-            candidates[number_of_combo_candidates].timeout_at = timestamp + combo->timeout_ms;
-            number_of_combo_candidates++;
-        }
-        // LOG_DBG("combo timeout %d %d %d", position, i, candidates[i].timeout_at);
-    }
-    return number_of_combo_candidates;
-}
-
-static int filter_candidates(int32_t position) {
-    // this code iterates over candidates and the lookup together to filter in O(n)
-    // assuming they are both sorted on key_position_len, virtal_key_position
-    int matches = 0, lookup_idx = 0, candidate_idx = 0;
-    while (lookup_idx < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY &&
-           candidate_idx < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY) {
-        struct combo_cfg *candidate = candidates[candidate_idx].combo;
-        struct combo_cfg *lookup = combo_lookup[position][lookup_idx];
-        if (candidate == NULL || lookup == NULL) {
-            break;
-        }
-        if (candidate->virtual_key_position == lookup->virtual_key_position) {
-            candidates[matches] = candidates[candidate_idx];
-            matches++;
-            candidate_idx++;
-            lookup_idx++;
-        } else if (candidate->key_position_len > lookup->key_position_len) {
-            lookup_idx++;
-        } else if (candidate->key_position_len < lookup->key_position_len) {
-            candidate_idx++;
-        } else if (candidate->virtual_key_position > lookup->virtual_key_position) {
-            lookup_idx++;
-        } else if (candidate->virtual_key_position < lookup->virtual_key_position) {
-            candidate_idx++;
-        }
-    }
-    // clear unmatched candidates
-    for (int i = matches; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        candidates[i].combo = NULL;
-    }
-    // LOG_DBG("combo matches after filter %d", matches);
-    return matches;
-}
-
-static int64_t first_candidate_timeout() {
-    int64_t first_timeout = LONG_MAX;
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        if (candidates[i].combo == NULL) {
-            break;
-        }
-        if (candidates[i].timeout_at < first_timeout) {
-            first_timeout = candidates[i].timeout_at;
-        }
-    }
-    return first_timeout;
-}
-
-static inline bool candidate_is_completely_pressed(struct combo_cfg *candidate) {
-    // this code assumes set(pressed_keys) <= set(candidate->key_positions)
-    // this invariant is enforced by filter_candidates
-    // since events may have been reraised after clearing one or more slots at
-    // the start of pressed_keys (see: release_pressed_keys), we have to check
-    // that each key needed to trigger the combo was pressed, not just the last.
-    for (int i = 0; i < candidate->key_position_len; i++) {
-        if (pressed_keys[i] == NULL) {
-            return false;
-        }
-    }
-    return true;
-}
-
 static int cleanup();
 
-static int filter_timed_out_candidates(int64_t timestamp) {
-    int remaining_candidates = 0;
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        struct combo_candidate *candidate = &candidates[i];
-        if (candidate->combo == NULL) {
-            break;
-        }
-        if (candidate->timeout_at > timestamp) {
-            bool need_to_bubble_up = remaining_candidates != i;
-            if (need_to_bubble_up) {
-                // bubble up => reorder candidates so they're contiguous
-                candidates[remaining_candidates].combo = candidate->combo;
-                candidates[remaining_candidates].timeout_at = candidate->timeout_at;
-                // clear the previous location
-                candidates[i].combo = NULL;
-                candidates[i].timeout_at = 0;
-            }
-
-            remaining_candidates++;
-        } else {
-            candidate->combo = NULL;
-        }
-    }
-
-    LOG_DBG(
-        "after filtering out timed out combo candidates: remaining_candidates=%d timestamp=%lld",
-        remaining_candidates, timestamp);
-
-    return remaining_candidates;
-}
-
-static int clear_candidates() {
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        if (candidates[i].combo == NULL) {
-            return i;
-        }
-        candidates[i].combo = NULL;
+// the number of captured keys before the first free slot.
+static int pressed_key_count() {
+    int count = 0;
+    while (count < ZMK_COMBO_PRESSED_KEYS_MAX && pressed_keys[count] != NULL) {
+        count++;
     }
-    return CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY;
+    return count;
 }
 
 static int capture_pressed_key(const zmk_event_t *ev) {
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO; i++) {
+    for (int i = 0; i < ZMK_COMBO_PRESSED_KEYS_MAX; i++) {
         if (pressed_keys[i] != NULL) {
             continue;
         }
         pressed_keys[i] = ev;
+        zmk_combo_position_mask_set(&pressed_mask, as_zmk_position_state_changed(ev)->position);
         return ZMK_EV_EVENT_CAPTURED;
     }
     return ZMK_EV_EVENT_BUBBLE;
@@ -275,27 +131,28 @@ static int capture_pressed_key(const zmk_event_t *ev) {
 const struct zmk_listener zmk_listener_combo;
 
 static int release_pressed_keys() {
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO; i++) {
+    for (int i = 0; i < ZMK_COMBO_PRESSED_KEYS_MAX; i++) {
         const zmk_event_t *captured_event = pressed_keys[i];
         if (pressed_keys[i] == NULL) {
             return i;
         }
         pressed_keys[i] = NULL;
+        int32_t position = as_zmk_position_state_changed(captured_event)->position;
+        zmk_combo_position_mask_clear(&pressed_mask, position);
         if (i == 0) {
-            LOG_DBG("combo: releasing position event %d",
-                    as_zmk_position_state_changed(captured_event)->position);
+            LOG_DBG("combo: releasing position event %d", position);
             ZMK_EVENT_RELEASE(captured_event)
         } else {
             // reprocess events (see tests/combo/fully-overlapping-combos-3 for why this is needed)
-            LOG_DBG("combo: reraising position event %d",
-                    as_zmk_position_state_changed(captured_event)->position);
+            LOG_DBG("combo: reraising position event %d", position);
             ZMK_EVENT_RAISE(captured_event);
         }
     }
-    return CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO;
+    return ZMK_COMBO_PRESSED_KEYS_MAX;
 }
 
-static inline int press_combo_behavior(struct combo_cfg *combo, int32_t timestamp) {
+static inline int press_combo_behavior(const struct combo_cfg *combo, int64_t timestamp) {
+    struct zmk_behavior_binding binding = combo->behavior;
     struct zmk_behavior_binding_event event = {
         .position = combo->virtual_key_position,
         .timestamp = timestamp,
@@ -303,35 +160,49 @@ static inline int press_combo_behavior(struct combo_cfg *combo, int32_t timestam
 
     last_combo_timestamp = timestamp;
 
-    return behavior_keymap_binding_pressed(&combo->behavior, event);
+    return behavior_keymap_binding_pressed(&binding, event);
 }
 
-static inline int release_combo_behavior(struct combo_cfg *combo, int32_t timestamp) {
+static inline int release_combo_behavior(const struct combo_cfg *combo, int64_t timestamp) {
+    struct zmk_behavior_binding binding = combo->behavior;
     struct zmk_behavior_binding_event event = {
         .position = combo->virtual_key_position,
         .timestamp = timestamp,
     };
 
-    return behavior_keymap_binding_released(&combo->behavior, event);
+    return behavior_keymap_binding_released(&binding, event);
 }
 
-static void move_pressed_keys_to_active_combo(struct active_combo *active_combo) {
-    int combo_length = active_combo->combo->key_position_len;
-    for (int i = 0; i < combo_length; i++) {
-        active_combo->key_positions_pressed[i] = pressed_keys[i];
-        pressed_keys[i] = NULL;
+// Moves the captured keys of the combo into the active combo, keeping the order of the
+// remaining captured keys. Returns the timestamp of the first key of the combo.
+static int64_t move_pressed_keys_to_active_combo(struct active_combo *active_combo) {
+    for (int i = 0; i < active_combo->combo->key_position_len; i++) {
+        zmk_combo_position_mask_set(&active_combo->keys, active_combo->combo->key_positions[i]);
     }
-    // move any other pressed keys up
-    for (int i = 0; i + combo_length < CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO; i++) {
-        if (pressed_keys[i + combo_length] == NULL) {
-            return;
+
+    int64_t timestamp = 0;
+    bool first = true;
+    int remaining = 0;
+    for (int i = 0; i < ZMK_COMBO_PRESSED_KEYS_MAX && pressed_keys[i] != NULL; i++) {
+        const zmk_event_t *captured_event = pressed_keys[i];
+        struct zmk_position_state_changed *data = as_zmk_position_state_changed(captured_event);
+        pressed_keys[i] = NULL;
+        if (!zmk_combo_position_mask_test(&active_combo->keys, data->position)) {
+            pressed_keys[remaining++] = captured_event;
+            continue;
         }
-        pressed_keys[i] = pressed_keys[i + combo_length];
-        pressed_keys[i + combo_length] = NULL;
+        if (first) {
+            timestamp = data->timestamp;
+            first = false;
+        }
+        active_combo_events[data->position] = captured_event;
+        zmk_combo_position_mask_set(&active_combo->held, data->position);
+        zmk_combo_position_mask_clear(&pressed_mask, data->position);
     }
+    return timestamp;
 }
 
-static struct active_combo *store_active_combo(struct combo_cfg *combo) {
+static struct active_combo *store_active_combo(const struct combo_cfg *combo) {
     for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_PRESSED_COMBOS; i++) {
         if (active_combos[i].combo == NULL) {
             active_combos[i].combo = combo;
@@ -345,16 +216,14 @@ static struct active_combo *store_active_combo(struct combo_cfg *combo) {
     return NULL;
 }
 
-static void activate_combo(struct combo_cfg *combo) {
+static void activate_combo(const struct combo_cfg *combo) {
     struct active_combo *active_combo = store_active_combo(combo);
     if (active_combo == NULL) {
         // unable to store combo
         release_pressed_keys();
         return;
     }
-    move_pressed_keys_to_active_combo(active_combo);
-    press_combo_behavior(
-        combo, as_zmk_position_state_changed(active_combo->key_positions_pressed[0])->timestamp);
+    press_combo_behavior(combo, move_pressed_keys_to_active_combo(active_combo));
 }
 
 static void deactivate_combo(int active_combo_index) {
@@ -363,7 +232,6 @@ static void deactivate_combo(int active_combo_index) {
         memcpy(&active_combos[active_combo_index], &active_combos[active_combo_count],
                sizeof(struct active_combo));
     }
-    active_combos[active_combo_count].combo = NULL;
     active_combos[active_combo_count] = (struct active_combo){0};
 }
 
@@ -371,40 +239,34 @@ static void deactivate_combo(int active_combo_index) {
 static bool release_combo_key(int32_t position, int64_t timestamp) {
     for (int combo_idx = 0; combo_idx < active_combo_count; combo_idx++) {
         struct active_combo *active_combo = &active_combos[combo_idx];
-
-        bool key_released = false;
-        bool all_keys_pressed = true;
-        bool all_keys_released = true;
-        for (int i = 0; i < active_combo->combo->key_position_len; i++) {
-            if (active_combo->key_positions_pressed[i] == NULL) {
-                all_keys_pressed = false;
-            } else if (as_zmk_position_state_changed(active_combo->key_positions_pressed[i])
-                           ->position != position) {
-                all_keys_released = false;
-            } else { // not null and position matches
-                ZMK_EVENT_FREE(active_combo->key_positions_pressed[i]);
-                active_combo->key_positions_pressed[i] = NULL;
-                key_released = true;
-            }
+        if (!zmk_combo_position_mask_test(&active_combo->held, position)) {
+            continue;
         }
 
-        if (key_released) {
-            if ((active_combo->combo->slow_release && all_keys_released) ||
-                (!active_combo->combo->slow_release && all_keys_pressed)) {
-                release_combo_behavior(active_combo->combo, timestamp);
-            }
-            if (all_keys_released) {
-                deactivate_combo(combo_idx);
-            }
-            return true;
+        const struct combo_cfg *combo = active_combo->combo;
+        bool all_keys_pressed =
+            zmk_combo_position_mask_equals(&active_combo->held, &active_combo->keys);
+
+        ZMK_EVENT_FREE(active_combo_events[position]);
+        active_combo_events[position] = NULL;
+        zmk_combo_position_mask_clear(&active_combo->held, position);
+
+        bool all_keys_released = zmk_combo_position_mask_is_empty(&active_combo->held);
+        if ((combo->slow_release && all_keys_released) ||
+            (!combo->slow_release && all_keys_pressed)) {
+            release_combo_behavior(combo, timestamp);
+        }
+        if (all_keys_released) {
+            deactivate_combo(combo_idx);
         }
+        return true;
     }
     return false;
 }
 
 static int cleanup() {
-    k_work_cancel_delayable(&timeout_task);
-    clear_candidates();
+    zmk_timer_stop(&timeout_task);
+    zmk_combo_candidates_clear();
     if (fully_pressed_combo != NULL) {
         activate_combo(fully_pressed_combo);
         fully_pressed_combo = NULL;
@@ -413,52 +275,45 @@ static int cleanup() {
 }
 
 static void update_timeout_task() {
-    int64_t first_timeout = first_candidate_timeout();
-    if (timeout_task_timeout_at == first_timeout) {
-        return;
-    }
+    int64_t first_timeout = zmk_combo_candidates_first_timeout();
     if (first_timeout == LLONG_MAX) {
-        timeout_task_timeout_at = 0;
-        k_work_cancel_delayable(&timeout_task);
+        zmk_timer_stop(&timeout_task);
         return;
     }
-    if (k_work_schedule(&timeout_task, K_MSEC(first_timeout - k_uptime_get())) >= 0) {
-        timeout_task_timeout_at = first_timeout;
+    if (!zmk_timer_is_pending(&timeout_task) || timeout_task.deadline != first_timeout) {
+        zmk_timer_start(&timeout_task, first_timeout);
     }
 }
 
 static int position_state_down(const zmk_event_t *ev, struct zmk_position_state_changed *data) {
     int num_candidates;
-    if (candidates[0].combo == NULL) {
-        num_candidates = setup_candidates_for_first_keypress(data->position, data->timestamp);
+    if (zmk_combo_candidates_is_empty()) {
+        num_candidates = zmk_combo_candidates_setup(data->position, data->timestamp);
         if (num_candidates == 0) {
             return ZMK_EV_EVENT_BUBBLE;
         }
     } else {
-        filter_timed_out_candidates(data->timestamp);
-        num_candidates = filter_candidates(data->position);
+        zmk_combo_candidates_filter_timed_out(data->timestamp);
+        num_candidates = zmk_combo_candidates_filter(data->position);
     }
     update_timeout_task();
 
-    struct combo_cfg *candidate_combo = candidates[0].combo;
     LOG_DBG("combo: capturing position event %d", data->position);
     int ret = capture_pressed_key(ev);
-    switch (num_candidates) {
-    case 0:
+    if (num_candidates == 0) {
         cleanup();
         return ret;
-    case 1:
-        if (candidate_is_completely_pressed(candidate_combo)) {
-            fully_pressed_combo = candidate_combo;
+    }
+
+    const struct combo_cfg *candidate_combo =
+        zmk_combo_candidates_completely_pressed(&pressed_mask, pressed_key_count());
+    if (candidate_combo != NULL) {
+        fully_pressed_combo = candidate_combo;
+        if (num_candidates == 1) {
             cleanup();
         }
-        return ret;
-    default:
-        if (candidate_is_completely_pressed(candidate_combo)) {
-            fully_pressed_combo = candidate_combo;
-        }
-        return ret;
     }
+    return ret;
 }
 
 static int position_state_up(const zmk_event_t *ev, struct zmk_position_state_changed *data) {
@@ -475,12 +330,8 @@ static int position_state_up(const zmk_event_t *ev, struct zmk_position_state_ch
     return ZMK_EV_EVENT_BUBBLE;
 }
 
-static void combo_timeout_handler(struct k_work *item) {
-    if (timeout_task_timeout_at == 0 || k_uptime_get() < timeout_task_timeout_at) {
-        // timer was cancelled or rescheduled.
-        return;
-    }
-    if (filter_timed_out_candidates(timeout_task_timeout_at) == 0) {
+static void combo_timeout_handler(struct zmk_timer *timer) {
+    if (zmk_combo_candidates_filter_timed_out(timer->deadline) == 0) {
         cleanup();
     }
     update_timeout_task();
@@ -488,7 +339,7 @@ static void combo_timeout_handler(struct k_work *item) {
 
 static int position_state_changed_listener(const zmk_event_t *ev) {
     struct zmk_position_state_changed *data = as_zmk_position_state_changed(ev);
-    if (data == NULL) {
+    if (data == NULL || data->position >= ZMK_KEYMAP_LEN) {
         return ZMK_EV_EVENT_BUBBLE;
     }
 
@@ -512,6 +363,8 @@ int behavior_combo_listener(const zmk_event_t *eh) {
         return position_state_changed_listener(eh);
     } else if (as_zmk_keycode_state_changed(eh) != NULL) {
         return keycode_state_changed_listener(eh);
+    } else if (as_zmk_layer_state_changed(eh) != NULL) {
+        zmk_combo_candidates_set_layer(zmk_keymap_highest_layer_active());
     }
     return ZMK_EV_EVENT_BUBBLE;
 }
@@ -519,27 +372,12 @@ int behavior_combo_listener(const zmk_event_t *eh) {
 ZMK_LISTENER(combo, behavior_combo_listener);
 ZMK_SUBSCRIPTION(combo, zmk_position_state_changed);
 ZMK_SUBSCRIPTION(combo, zmk_keycode_state_changed);
-
-#define COMBO_INST(n)                                                                              \
-    static struct combo_cfg combo_config_##n = {                                                   \
-        .timeout_ms = DT_PROP(n, timeout_ms),                                                      \
-        .require_prior_idle_ms = DT_PROP(n, require_prior_idle_ms),                                \
-        .key_positions = DT_PROP(n, key_positions),                                                \
-        .key_position_len = DT_PROP_LEN(n, key_positions),                                         \
-        .behavior = ZMK_KEYMAP_EXTRACT_BINDING(0, n),                                              \
-        .virtual_key_position = ZMK_VIRTUAL_KEY_POSITION_COMBO(__COUNTER__),                       \
-        .slow_release = DT_PROP(n, slow_release),                                                  \
-        .layers = DT_PROP(n, layers),                                                              \
-        .layers_len = DT_PROP_LEN(n, layers),                                                      \
-    };
-
-#define INITIALIZE_COMBO(n) initialize_combo(&combo_config_##n);
-
-DT_INST_FOREACH_CHILD(0, COMBO_INST)
+ZMK_SUBSCRIPTION(combo, zmk_layer_state_changed);
 
 static int combo_init() {
-    k_work_init_delayable(&timeout_task, combo_timeout_handler);
-    DT_INST_FOREACH_CHILD(0, INITIALIZE_COMBO);
+    zmk_timer_init(&timeout_task, combo_timeout_handler);
+    zmk_combo_candidates_init(combos, ARRAY_SIZE(combos));
+    zmk_combo_candidates_set_layer(zmk_keymap_highest_layer_active());
     return 0;
 }
 
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_combos
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include <zmk/combo_engine.h>
+#include <zmk/keymap.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+/*
+ * Chord table combo candidates.
+ *
+ * Every combo is stored as a bitmap of its key positions. A second set of bitmaps maps each key
+ * position to the set of combos using it, so narrowing down the candidates on a key press is a
+ * single AND. Whether the captured keys form a complete combo is answered by an open addressing
+ * hash table keyed by the position bitmap, independent of the number of combos.
+ */
+
+#define COMBO_CHILD_PLUS_ONE(n) 1 +
+#define COMBO_COUNT (DT_INST_FOREACH_CHILD(0, COMBO_CHILD_PLUS_ONE) 0)
+
+#define COMBO_SET_WORDS DIV_ROUND_UP(MAX(COMBO_COUNT, 1), 32)
+// the hash table is kept at most half full so probe sequences stay short.
+#define COMBO_HASH_SIZE (2 * COMBO_COUNT + 1)
+// keymaps typically use only a handful of distinct combo timeouts.
+#define COMBO_TIMEOUT_GROUPS_MAX 8
+
+BUILD_ASSERT(COMBO_COUNT < UINT16_MAX, "Too many combos for the chord table");
+
+struct combo_set {
+    uint32_t words[COMBO_SET_WORDS];
+};
+
+// the combos sharing a timeout, so candidates time out a group at a time.
+struct timeout_group {
+    int32_t timeout_ms;
+    struct combo_set combos;
+};
+
+// the combos passed to zmk_combo_candidates_init, in devicetree order
+static const struct combo_cfg *combo_cfgs;
+// the key positions of each combo, indexed like combo_cfgs[]
+static struct zmk_combo_position_mask combo_masks[COMBO_COUNT];
+// the set of combos that use each key position
+static struct combo_set position_combos[ZMK_KEYMAP_LEN];
+// the set of combos that can trigger on the highest active layer.
+// it is rebuilt whenever the layer state changes.
+static struct combo_set layer_combos;
+// maps a key position bitmap to the combos using exactly those positions.
+// Entries hold the combo index + 1; 0 marks an empty slot.
+static uint16_t combo_hash[COMBO_HASH_SIZE];
+// the combos grouped by timeout, sorted by ascending timeout
+static struct timeout_group timeout_groups[COMBO_TIMEOUT_GROUPS_MAX];
+static int timeout_group_count;
+// combos whose timeout did not fit in a group; these are checked one by one.
+static struct combo_set ungrouped_combos;
+
+// the set of candidate combos based on the currently pressed keys
+static struct combo_set candidates;
+// the time of the key press that set up the candidates; all timeouts are relative to it.
+static int64_t candidates_timestamp;
+
+static uint32_t position_mask_hash(const struct zmk_combo_position_mask *mask) {
+    // FNV-1a over the mask words
+    uint32_t hash = 2166136261U;
+    for (int i = 0; i < ARRAY_SIZE(mask->words); i++) {
+        hash = (hash ^ mask->words[i]) * 16777619U;
+    }
+    return hash;
+}
+
+static inline void combo_set_add(struct combo_set *set, int index) {
+    set->words[index / 32] |= BIT(index % 32);
+}
+
+static inline void combo_set_remove(struct combo_set *set, int index) {
+    set->words[index / 32] &= ~BIT(index % 32);
+}
+
+static inline bool combo_set_test(const struct combo_set *set, int index) {
+    return (set->words[index / 32] & BIT(index % 32)) != 0;
+}
+
+static inline bool combo_set_is_empty(const struct combo_set *set) {
+    for (int i = 0; i < COMBO_SET_WORDS; i++) {
+        if (set->words[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns the index of the first combo in the set at or after `from`, or -1 if there is none.
+static int combo_set_next(const struct combo_set *set, int from) {
+    for (int i = from / 32; i < COMBO_SET_WORDS; i++) {
+        uint32_t word = set->words[i];
+        if (i == from / 32) {
+            word &= ~(BIT(from % 32) - 1);
+        }
+        if (word != 0) {
+            return i * 32 + find_lsb_set(word) - 1;
+        }
+    }
+    return -1;
+}
+
+#define COMBO_SET_FOREACH(set, index)                                                              \
+    for (int index = combo_set_next(set, 0); index >= 0; index = combo_set_next(set, index + 1))
+
+static void add_to_timeout_group(int index) {
+    int32_t timeout_ms = combo_cfgs[index].timeout_ms;
+    int i = 0;
+    while (i < timeout_group_count && timeout_groups[i].timeout_ms < timeout_ms) {
+        i++;
+    }
+    if (i < timeout_group_count && timeout_groups[i].timeout_ms == timeout_ms) {
+        combo_set_add(&timeout_groups[i].combos, index);
+        return;
+    }
+    if (timeout_group_count == COMBO_TIMEOUT_GROUPS_MAX) {
+        combo_set_add(&ungrouped_combos, index);
+        return;
+    }
+    memmove(&timeout_groups[i + 1], &timeout_groups[i],
+            (timeout_group_count - i) * sizeof(struct timeout_group));
+    timeout_groups[i] = (struct timeout_group){.timeout_ms = timeout_ms};
+    combo_set_add(&timeout_groups[i].combos, index);
+    timeout_group_count++;
+}
+
+static bool combo_set_intersects(const struct combo_set *a, const struct combo_set *b) {
+    for (int i = 0; i < COMBO_SET_WORDS; i++) {
+        if (a->words[i] & b->words[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int initialize_combo(int index) {
+    const struct combo_cfg *combo = &combo_cfgs[index];
+    for (int i = 0; i < combo->key_position_len; i++) {
+        int32_t position = combo->key_positions[i];
+        if (position >= ZMK_KEYMAP_LEN) {
+            LOG_ERR("Unable to initialize combo, key position %d does not exist", position);
+            return -EINVAL;
+        }
+    }
+
+    struct zmk_combo_position_mask *mask = &combo_masks[index];
+    for (int i = 0; i < combo->key_position_len; i++) {
+        zmk_combo_position_mask_set(mask, combo->key_positions[i]);
+        combo_set_add(&position_combos[combo->key_positions[i]], index);
+    }
+
+    // combos are inserted in devicetree order, so combos with identical key positions are
+    // found in that order as well.
+    uint32_t slot = position_mask_hash(mask) % COMBO_HASH_SIZE;
+    while (combo_hash[slot] != 0) {
+        slot = (slot + 1) % COMBO_HASH_SIZE;
+    }
+    combo_hash[slot] = index + 1;
+
+    add_to_timeout_group(index);
+    return 0;
+}
+
+int zmk_combo_candidates_init(const struct combo_cfg *combos, int count) {
+    __ASSERT(count == COMBO_COUNT, "Chord table is sized for %d combos", COMBO_COUNT);
+    combo_cfgs = combos;
+    int ret = 0;
+    for (int i = 0; i < count; i++) {
+        int err = initialize_combo(i);
+        if (err < 0) {
+            ret = err;
+        }
+    }
+    LOG_DBG("combo: %d combos in chord table", count);
+    return ret;
+}
+
+static bool combo_active_on_layer(const struct combo_cfg *combo, uint8_t layer) {
+    return (combo->layer_mask & BIT(layer)) != 0;
+}
+
+void zmk_combo_candidates_set_layer(uint8_t layer) {
+    for (int i = 0; i < COMBO_COUNT; i++) {
+        if (combo_active_on_layer(&combo_cfgs[i], layer)) {
+            combo_set_add(&layer_combos, i);
+        } else {
+            combo_set_remove(&layer_combos, i);
+        }
+    }
+}
+
+int zmk_combo_candidates_setup(int32_t position, int64_t timestamp) {
+    int number_of_combo_candidates = 0;
+    for (int i = 0; i < COMBO_SET_WORDS; i++) {
+        candidates.words[i] = position_combos[position].words[i] & layer_combos.words[i];
+    }
+    COMBO_SET_FOREACH(&candidates, i) {
+        if (zmk_combo_is_quick_tap(&combo_cfgs[i], timestamp)) {
+            combo_set_remove(&candidates, i);
+        } else {
+            number_of_combo_candidates++;
+        }
+    }
+    candidates_timestamp = timestamp;
+    return number_of_combo_candidates;
+}
+
+int zmk_combo_candidates_filter(int32_t position) {
+    int matches = 0;
+    for (int i = 0; i < COMBO_SET_WORDS; i++) {
+        candidates.words[i] &= position_combos[position].words[i];
+        matches += __builtin_popcount(candidates.words[i]);
+    }
+    return matches;
+}
+
+int zmk_combo_candidates_filter_timed_out(int64_t timestamp) {
+    for (int g = 0; g < timeout_group_count; g++) {
+        const struct timeout_group *group = &timeout_groups[g];
+        if (candidates_timestamp + group->timeout_ms > timestamp) {
+            break;
+        }
+        for (int i = 0; i < COMBO_SET_WORDS; i++) {
+            candidates.words[i] &= ~group->combos.words[i];
+        }
+    }
+    COMBO_SET_FOREACH(&ungrouped_combos, i) {
+        if (candidates_timestamp + combo_cfgs[i].timeout_ms <= timestamp) {
+            combo_set_remove(&candidates, i);
+        }
+    }
+
+    int remaining_candidates = 0;
+    for (int i = 0; i < COMBO_SET_WORDS; i++) {
+        remaining_candidates += __builtin_popcount(candidates.words[i]);
+    }
+
+    LOG_DBG(
+        "after filtering out timed out combo candidates: remaining_candidates=%d timestamp=%lld",
+        remaining_candidates, timestamp);
+
+    return remaining_candidates;
+}
+
+int64_t zmk_combo_candidates_first_timeout(void) {
+    int32_t first_timeout_ms = INT32_MAX;
+    for (int g = 0; g < timeout_group_count; g++) {
+        if (combo_set_intersects(&timeout_groups[g].combos, &candidates)) {
+            first_timeout_ms = timeout_groups[g].timeout_ms;
+            break;
+        }
+    }
+    if (combo_set_intersects(&ungrouped_combos, &candidates)) {
+        COMBO_SET_FOREACH(&ungrouped_combos, i) {
+            if (combo_set_test(&candidates, i)) {
+                first_timeout_ms = MIN(first_timeout_ms, combo_cfgs[i].timeout_ms);
+            }
+        }
+    }
+    if (first_timeout_ms == INT32_MAX) {
+        return LLONG_MAX;
+    }
+    return candidates_timestamp + first_timeout_ms;
+}
+
+bool zmk_combo_candidates_is_empty(void) { return combo_set_is_empty(&candidates); }
+
+void zmk_combo_candidates_clear(void) { memset(&candidates, 0, sizeof(candidates)); }
+
+// Candidates are supersets of the captured keys, so the candidate made up of exactly the captured
+// keys is also the shortest one.
+const struct combo_cfg *
+zmk_combo_candidates_completely_pressed(const struct zmk_combo_position_mask *pressed,
+                                        int pressed_count) {
+    uint32_t slot = position_mask_hash(pressed) % COMBO_HASH_SIZE;
+    for (; combo_hash[slot] != 0; slot = (slot + 1) % COMBO_HASH_SIZE) {
+        int index = combo_hash[slot] - 1;
+        if (combo_set_test(&candidates, index) &&
+            zmk_combo_position_mask_equals(&combo_masks[index], pressed)) {
+            return &combo_cfgs[index];
+        }
+    }
+    return NULL;
+}
+
+#endif
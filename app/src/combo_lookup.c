@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2020 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_combos
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/combo_engine.h>
+#include <zmk/keymap.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+struct combo_candidate {
+    const struct combo_cfg *combo;
+    // the time after which this behavior should be removed from candidates.
+    // by keeping track of when the candidate should be cleared there is no
+    // possibility of accidental releases.
+    int64_t timeout_at;
+};
+
+// the set of candidate combos based on the currently pressed keys
+static struct combo_candidate candidates[CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY];
+// a lookup dict that maps a key position to all combos on that position
+static const struct combo_cfg *combo_lookup[ZMK_KEYMAP_LEN][CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY] = {
+    NULL};
+// the subset of combo_lookup that can trigger on the highest active layer, in the same order.
+// it is rebuilt whenever the layer state changes.
+static const struct combo_cfg
+    *layer_combo_lookup[ZMK_KEYMAP_LEN][CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY] = {NULL};
+
+// Store the combo key pointer in the combos array, one pointer for each key position
+// The combos are sorted shortest-first, then by virtual-key-position.
+static int initialize_combo(const struct combo_cfg *new_combo) {
+    if (new_combo->key_position_len > CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO) {
+        LOG_ERR("Unable to initialize combo, %d key positions but "
+                "CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO is %d",
+                new_combo->key_position_len, CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO);
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < new_combo->key_position_len; i++) {
+        int32_t position = new_combo->key_positions[i];
+        if (position >= ZMK_KEYMAP_LEN) {
+            LOG_ERR("Unable to initialize combo, key position %d does not exist", position);
+            return -EINVAL;
+        }
+
+        const struct combo_cfg *insert_combo = new_combo;
+        bool set = false;
+        for (int j = 0; j < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; j++) {
+            const struct combo_cfg *combo_at_j = combo_lookup[position][j];
+            if (combo_at_j == NULL) {
+                combo_lookup[position][j] = insert_combo;
+                set = true;
+                break;
+            }
+            if (combo_at_j->key_position_len < insert_combo->key_position_len ||
+                (combo_at_j->key_position_len == insert_combo->key_position_len &&
+                 combo_at_j->virtual_key_position < insert_combo->virtual_key_position)) {
+                continue;
+            }
+            // put insert_combo in this spot, move all other combos up.
+            combo_lookup[position][j] = insert_combo;
+            insert_combo = combo_at_j;
+        }
+        if (!set) {
+            LOG_ERR("Too many combos for key position %d, CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY %d.",
+                    position, CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY);
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+int zmk_combo_candidates_init(const struct combo_cfg *combos, int count) {
+    int ret = 0;
+    for (int i = 0; i < count; i++) {
+        int err = initialize_combo(&combos[i]);
+        if (err < 0) {
+            ret = err;
+        }
+    }
+    return ret;
+}
+
+static bool combo_active_on_layer(const struct combo_cfg *combo, uint8_t layer) {
+    return (combo->layer_mask & BIT(layer)) != 0;
+}
+
+void zmk_combo_candidates_set_layer(uint8_t layer) {
+    for (int position = 0; position < ZMK_KEYMAP_LEN; position++) {
+        int count = 0;
+        for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
+            const struct combo_cfg *combo = combo_lookup[position][i];
+            if (combo == NULL) {
+                break;
+            }
+            if (combo_active_on_layer(combo, layer)) {
+                layer_combo_lookup[position][count++] = combo;
+            }
+        }
+        for (int i = count; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
+            layer_combo_lookup[position][i] = NULL;
+        }
+    }
+}
+
+int zmk_combo_candidates_setup(int32_t position, int64_t timestamp) {
+    int number_of_combo_candidates = 0;
+    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
+        const struct combo_cfg *combo = layer_combo_lookup[position][i];
+        if (combo == NULL) {
+            return number_of_combo_candidates;
+        }
+        if (!zmk_combo_is_quick_tap(combo, timestamp)) {
+            candidates[number_of_combo_candidates].combo = combo;
+            candidates[number_of_combo_candidates].timeout_at = timestamp + combo->timeout_ms;
+            number_of_combo_candidates++;
+        }
+    }
+    return number_of_combo_candidates;
+}
+
+int zmk_combo_candidates_filter(int32_t position) {
+    // this code iterates over candidates and the lookup together to filter in O(n)
+    // assuming they are both sorted on key_position_len, virtal_key_position
+    int matches = 0, lookup_idx = 0, candidate_idx = 0;
+    while (lookup_idx < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY &&
+           candidate_idx < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY) {
+        const struct combo_cfg *candidate = candidates[candidate_idx].combo;
+        const struct combo_cfg *lookup = combo_lookup[position][lookup_idx];
+        if (candidate == NULL || lookup == NULL) {
+            break;
+        }
+        if (candidate->virtual_key_position == lookup->virtual_key_position) {
+            candidates[matches] = candidates[candidate_idx];
+            matches++;
+            candidate_idx++;
+            lookup_idx++;
+        } else if (candidate->key_position_len > lookup->key_position_len) {
+            lookup_idx++;
+        } else if (candidate->key_position_len < lookup->key_position_len) {
+            candidate_idx++;
+        } else if (candidate->virtual_key_position > lookup->virtual_key_position) {
+            lookup_idx++;
+        } else if (candidate->virtual_key_position < lookup->virtual_key_position) {
+            candidate_idx++;
+        }
+    }
+    // clear unmatched candidates
+    for (int i = matches; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
+        candidates[i].combo = NULL;
+    }
+    return matches;
+}
+
+int zmk_combo_candidates_filter_timed_out(int64_t timestamp) {
+    int remaining_candidates = 0;
+    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
+        struct combo_candidate *candidate = &candidates[i];
+        if (candidate->combo == NULL) {
+            break;
+        }
+        if (candidate->timeout_at > timestamp) {
+            bool need_to_bubble_up = remaining_candidates != i;
+            if (need_to_bubble_up) {
+                // bubble up => reorder candidates so they're contiguous
+                candidates[remaining_candidates].combo = candidate->combo;
+                candidates[remaining_candidates].timeout_at = candidate->timeout_at;
+                // clear the previous location
+                candidates[i].combo = NULL;
+                candidates[i].timeout_at = 0;
+            }
+
+            remaining_candidates++;
+        } else {
+            candidate->combo = NULL;
+        }
+    }
+
+    LOG_DBG(
+        "after filtering out timed out combo candidates: remaining_candidates=%d timestamp=%lld",
+        remaining_candidates, timestamp);
+
+    return remaining_candidates;
+}
+
+int64_t zmk_combo_candidates_first_timeout(void) {
+    int64_t first_timeout = LLONG_MAX;
+    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
+        if (candidates[i].combo == NULL) {
+            break;
+        }
+        if (candidates[i].timeout_at < first_timeout) {
+            first_timeout = candidates[i].timeout_at;
+        }
+    }
+    return first_timeout;
+}
+
+bool zmk_combo_candidates_is_empty(void) { return candidates[0].combo == NULL; }
+
+void zmk_combo_candidates_clear(void) {
+    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
+        if (candidates[i].combo == NULL) {
+            return;
+        }
+        candidates[i].combo = NULL;
+    }
+}
+
+const struct combo_cfg *
+zmk_combo_candidates_completely_pressed(const struct zmk_combo_position_mask *pressed,
+                                        int pressed_count) {
+    // the captured keys are a subset of the key positions of every candidate, which is enforced
+    // by zmk_combo_candidates_filter, and the candidates are sorted shortest-first. So the first
+    // candidate is completely pressed once as many keys as it has are captured.
+    const struct combo_cfg *candidate = candidates[0].combo;
+    if (candidate != NULL && candidate->key_position_len <= pressed_count) {
+        return candidate;
+    }
+    return NULL;
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include <zephyr/settings/settings.h>
 
 #include <stdio.h>
+#include <string.h>
 
 #include <zmk/ble.h>
 #include <zmk/endpoints.h>
@@ -118,9 +119,7 @@ int zmk_endpoints_toggle_transport(void) {
 
 struct zmk_endpoint_instance zmk_endpoints_selected(void) { return current_instance; }
 
-static int send_keyboard_report(void) {
-    struct zmk_hid_keyboard_report *keyboard_report = zmk_hid_get_keyboard_report();
-
+static int send_keyboard_report(struct zmk_hid_keyboard_report *keyboard_report) {
     switch (current_instance.transport) {
 #if IS_ENABLED(CONFIG_ZMK_USB)
     case ZMK_TRANSPORT_USB: {
@@ -147,9 +146,7 @@ static int send_keyboard_report(void) {
     return -ENOTSUP;
 }
 
-static int send_consumer_report(void) {
-    struct zmk_hid_consumer_report *consumer_report = zmk_hid_get_consumer_report();
-
+static int send_consumer_report(struct zmk_hid_consumer_report *consumer_report) {
     switch (current_instance.transport) {
 #if IS_ENABLED(CONFIG_ZMK_USB)
     case ZMK_TRANSPORT_USB: {
@@ -176,25 +173,208 @@ static int send_consumer_report(void) {
     return -ENOTSUP;
 }
 
+static bool is_report_ready(uint16_t usage_page) {
+    switch (current_instance.transport) {
+#if IS_ENABLED(CONFIG_ZMK_USB)
+    case ZMK_TRANSPORT_USB:
+        return zmk_usb_hid_is_ready(usage_page == HID_USAGE_CONSUMER ? ZMK_HID_REPORT_ID_CONSUMER
+                                                                     : ZMK_HID_REPORT_ID_KEYBOARD);
+#endif /* IS_ENABLED(CONFIG_ZMK_USB) */
+
+#if IS_ENABLED(CONFIG_ZMK_BLE)
+    case ZMK_TRANSPORT_BLE:
+        return usage_page == HID_USAGE_CONSUMER ? zmk_hog_consumer_report_queue_has_space()
+                                                : zmk_hog_keyboard_report_queue_has_space();
+#endif /* IS_ENABLED(CONFIG_ZMK_BLE) */
+    }
+
+    // Reports to unsupported transports fail right away.
+    return true;
+}
+
+// Changes to the keyboard and consumer reports are coalesced before being sent. Every
+// zmk_endpoints_send_report() call takes a snapshot of the report, and the latest snapshot is only
+// sent once the current event has been handled and the endpoint can take another report, which
+// happens once per USB poll or as space frees up in the HOG queue. Snapshots that would hide an
+// earlier unsent change from the host, such as a key pre-released and pressed again, flush the
+// pending reports first, so every state the host has to see is still sent in order.
+struct coalesced_report {
+    uint16_t usage_page;
+    size_t len;
+    uint8_t *current;
+    // Snapshot taken by the latest zmk_endpoints_send_report() call.
+    uint8_t *pending;
+    // Last snapshot the transport accepted.
+    uint8_t *sent;
+    bool dirty;
+};
+
+// Reports are flushed at the latest this long after they were first changed, even if the endpoint
+// still isn't ready, matching how long a USB report used to wait for the previous one to go out.
+#define FLUSH_MAX_DELAY_MS 30
+#define FLUSH_RETRY_MS 1
+
+static struct zmk_hid_keyboard_report keyboard_pending;
+static struct zmk_hid_keyboard_report keyboard_sent;
+static struct zmk_hid_consumer_report consumer_pending;
+static struct zmk_hid_consumer_report consumer_sent;
+
+static struct coalesced_report coalesced_reports[] = {
+    {.usage_page = HID_USAGE_KEY,
+     .len = sizeof(struct zmk_hid_keyboard_report),
+     .pending = (uint8_t *)&keyboard_pending,
+     .sent = (uint8_t *)&keyboard_sent},
+    {.usage_page = HID_USAGE_CONSUMER,
+     .len = sizeof(struct zmk_hid_consumer_report),
+     .pending = (uint8_t *)&consumer_pending,
+     .sent = (uint8_t *)&consumer_sent},
+};
+
+// Dirty reports in the order they were first changed.
+static struct coalesced_report *dirty_reports[ARRAY_SIZE(coalesced_reports)];
+static uint8_t dirty_count;
+static int64_t dirty_since;
+
+// Mouse reports are sent from the mouse work queue, which flushes the coalesced reports as well.
+static K_MUTEX_DEFINE(coalesce_lock);
+
+static void flush_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(flush_work, flush_work_handler);
+
+// Sends the dirty reports in order. A report that fails to send stays dirty, along with the ones
+// after it, and goes out with the next flush. Must be called with coalesce_lock held.
+static int flush_reports(void) {
+    int err = 0;
+    int i;
+
+    for (i = 0; i < dirty_count; i++) {
+        struct coalesced_report *report = dirty_reports[i];
+
+        switch (report->usage_page) {
+        case HID_USAGE_KEY:
+            err = send_keyboard_report((struct zmk_hid_keyboard_report *)report->pending);
+            break;
+        case HID_USAGE_CONSUMER:
+            err = send_consumer_report((struct zmk_hid_consumer_report *)report->pending);
+            break;
+        default:
+            err = -ENOTSUP;
+            break;
+        }
+
+        if (err) {
+            break;
+        }
+
+        memcpy(report->sent, report->pending, report->len);
+        report->dirty = false;
+    }
+
+    memmove(dirty_reports, &dirty_reports[i], (dirty_count - i) * sizeof(dirty_reports[0]));
+    dirty_count -= i;
+    return err;
+}
+
+static void flush_work_handler(struct k_work *work) {
+    k_mutex_lock(&coalesce_lock, K_FOREVER);
+
+    for (int i = 0; i < dirty_count; i++) {
+        if (!is_report_ready(dirty_reports[i]->usage_page) &&
+            k_uptime_get() - dirty_since < FLUSH_MAX_DELAY_MS) {
+            k_work_schedule(&flush_work, K_MSEC(FLUSH_RETRY_MS));
+            k_mutex_unlock(&coalesce_lock);
+            return;
+        }
+    }
+
+    if (flush_reports() && k_uptime_get() - dirty_since < FLUSH_MAX_DELAY_MS) {
+        k_work_schedule(&flush_work, K_MSEC(FLUSH_RETRY_MS));
+    }
+
+    k_mutex_unlock(&coalesce_lock);
+}
+
+// Whether replacing the pending snapshot with the current report has to wait until the pending one
+// has been sent: either it would revert bits that changed since the last sent report, or another
+// report changed after this one, and sending them in one go would reorder the changes.
+static bool needs_flush(const struct coalesced_report *report) {
+    if (!report->dirty || memcmp(report->current, report->pending, report->len) == 0) {
+        return false;
+    }
+
+    if (dirty_reports[dirty_count - 1] != report) {
+        return true;
+    }
+
+    for (size_t i = 0; i < report->len; i++) {
+        if ((report->sent[i] ^ report->pending[i]) & (report->pending[i] ^ report->current[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 int zmk_endpoints_send_report(uint16_t usage_page) {
 
     LOG_DBG("usage page 0x%02X", usage_page);
-    switch (usage_page) {
-    case HID_USAGE_KEY:
-        return send_keyboard_report();
 
-    case HID_USAGE_CONSUMER:
-        return send_consumer_report();
+    struct coalesced_report *report = NULL;
+    for (int i = 0; i < ARRAY_SIZE(coalesced_reports); i++) {
+        if (coalesced_reports[i].usage_page == usage_page) {
+            report = &coalesced_reports[i];
+            break;
+        }
     }
 
-    LOG_ERR("Unsupported usage page %d", usage_page);
-    return -ENOTSUP;
+    if (report == NULL) {
+        LOG_ERR("Unsupported usage page %d", usage_page);
+        return -ENOTSUP;
+    }
+
+    k_mutex_lock(&coalesce_lock, K_FOREVER);
+
+    int err = 0;
+    if (needs_flush(report)) {
+        err = flush_reports();
+    }
+
+    memcpy(report->pending, report->current, report->len);
+
+    if (!report->dirty) {
+        if (memcmp(report->pending, report->sent, report->len) == 0) {
+            // The host already has this report.
+            k_mutex_unlock(&coalesce_lock);
+            return err;
+        }
+
+        if (dirty_count == 0) {
+            dirty_since = k_uptime_get();
+        }
+        report->dirty = true;
+        dirty_reports[dirty_count++] = report;
+    }
+
+    k_work_schedule(&flush_work, K_NO_WAIT);
+
+    k_mutex_unlock(&coalesce_lock);
+    return err;
 }
 
+bool zmk_endpoints_keyboard_report_ready(void) { return is_report_ready(HID_USAGE_KEY); }
+
 #if IS_ENABLED(CONFIG_ZMK_MOUSE)
 int zmk_endpoints_send_mouse_report() {
     struct zmk_hid_mouse_report *mouse_report = zmk_hid_get_mouse_report();
 
+    // Mouse reports aren't coalesced, so pending key changes, such as a modifier for a click, have
+    // to go out before them.
+    k_mutex_lock(&coalesce_lock, K_FOREVER);
+    if (dirty_count > 0) {
+        flush_reports();
+    }
+    k_mutex_unlock(&coalesce_lock);
+
     switch (current_instance.transport) {
 #if IS_ENABLED(CONFIG_ZMK_USB)
     case ZMK_TRANSPORT_USB: {
@@ -305,6 +485,16 @@ static struct zmk_endpoint_instance get_selected_instance(void) {
 }
 
 static int zmk_endpoints_init(const struct device *_arg) {
+    for (int i = 0; i < ARRAY_SIZE(coalesced_reports); i++) {
+        struct coalesced_report *report = &coalesced_reports[i];
+
+        report->current = report->usage_page == HID_USAGE_KEY
+                              ? (uint8_t *)zmk_hid_get_keyboard_report()
+                              : (uint8_t *)zmk_hid_get_consumer_report();
+        memcpy(report->pending, report->current, report->len);
+        memcpy(report->sent, report->current, report->len);
+    }
+
 #if IS_ENABLED(CONFIG_SETTINGS)
     settings_subsys_init();
 
@@ -333,6 +523,11 @@ static void disconnect_current_endpoint() {
 
     zmk_endpoints_send_report(HID_USAGE_KEY);
     zmk_endpoints_send_report(HID_USAGE_CONSUMER);
+
+    // The released keys have to reach the old endpoint before switching away from it.
+    k_mutex_lock(&coalesce_lock, K_FOREVER);
+    flush_reports();
+    k_mutex_unlock(&coalesce_lock);
 }
 
 static void update_current_endpoint(void) {
@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/kernel.h>
+#include <zmk/events/ble_link_updated.h>
+
+ZMK_EVENT_IMPL(zmk_ble_link_updated);
\ No newline at end of file
@@ -8,17 +8,22 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
+#include <zephyr/sys/byteorder.h>
+
 #include <zmk/hid.h>
 #include <dt-bindings/zmk/modifiers.h>
 
 static struct zmk_hid_keyboard_report keyboard_report = {
-    .report_id = 1, .body = {.modifiers = 0, ._reserved = 0, .keys = {0}}};
+    .report_id = ZMK_HID_REPORT_ID_KEYBOARD,
+    .body = {.modifiers = 0, ._reserved = 0, .keys = {0}}};
 
-static struct zmk_hid_consumer_report consumer_report = {.report_id = 2, .body = {.keys = {0}}};
+static struct zmk_hid_consumer_report consumer_report = {.report_id = ZMK_HID_REPORT_ID_CONSUMER,
+                                                         .body = {.keys = {0}}};
 
 #if IS_ENABLED(CONFIG_ZMK_MOUSE)
 static struct zmk_hid_mouse_report mouse_report = {
-    .report_id = 4, .body = {.buttons = 0, .x = 0, .y = 0, .scroll_x = 0, .scroll_y = 0}};
+    .report_id = ZMK_HID_REPORT_ID_MOUSE,
+    .body = {.buttons = 0, .x = 0, .y = 0, .scroll_x = 0, .scroll_y = 0}};
 #endif
 
 // Keep track of how often a modifier was pressed.
@@ -91,13 +96,27 @@ int zmk_hid_unregister_mods(zmk_mod_flags_t modifiers) {
 
 #if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_NKRO)
 
-#define TOGGLE_KEYBOARD(code, val) WRITE_BIT(keyboard_report.body.keys[code / 8], code % 8, val)
+// Word-aligned copy of the key bitmap, which can't be aligned inside the packed report. Batches of
+// usages are applied to it a word at a time before being copied into the report.
+static uint32_t keyboard_keys[ZMK_HID_KEYBOARD_USAGE_MASK_WORDS];
+
+// Bits of the last word that map to usages in the report.
+#define LAST_WORD_MASK BIT_MASK((ZMK_HID_KEYBOARD_NKRO_MAX_USAGE % 32) + 1)
+
+static void sync_keyboard_keys() {
+    uint8_t keys[sizeof(keyboard_keys)];
+    for (int i = 0; i < ZMK_HID_KEYBOARD_USAGE_MASK_WORDS; i++) {
+        sys_put_le32(keyboard_keys[i], &keys[i * 4]);
+    }
+    memcpy(keyboard_report.body.keys, keys, sizeof(keyboard_report.body.keys));
+}
 
 static inline int select_keyboard_usage(zmk_key_t usage) {
     if (usage > ZMK_HID_KEYBOARD_NKRO_MAX_USAGE) {
         return -EINVAL;
     }
-    TOGGLE_KEYBOARD(usage, 1);
+    keyboard_keys[usage / 32] |= BIT(usage % 32);
+    keyboard_report.body.keys[usage / 8] |= BIT(usage % 8);
     return 0;
 }
 
@@ -105,7 +124,8 @@ static inline int deselect_keyboard_usage(zmk_key_t usage) {
     if (usage > ZMK_HID_KEYBOARD_NKRO_MAX_USAGE) {
         return -EINVAL;
     }
-    TOGGLE_KEYBOARD(usage, 0);
+    keyboard_keys[usage / 32] &= ~BIT(usage % 32);
+    keyboard_report.body.keys[usage / 8] &= ~BIT(usage % 8);
     return 0;
 }
 
@@ -113,39 +133,140 @@ static inline bool check_keyboard_usage(zmk_key_t usage) {
     if (usage > ZMK_HID_KEYBOARD_NKRO_MAX_USAGE) {
         return false;
     }
-    return keyboard_report.body.keys[usage / 8] & (1 << (usage % 8));
+    return keyboard_keys[usage / 32] & BIT(usage % 32);
+}
+
+static int select_keyboard_usages(const struct zmk_hid_keyboard_usage_mask *mask) {
+    uint32_t changed = 0;
+    for (int i = 0; i < ZMK_HID_KEYBOARD_USAGE_MASK_WORDS; i++) {
+        uint32_t words = mask->words[i];
+        if (i == ZMK_HID_KEYBOARD_USAGE_MASK_WORDS - 1) {
+            words &= LAST_WORD_MASK;
+        }
+        changed |= words & ~keyboard_keys[i];
+        keyboard_keys[i] |= words;
+    }
+
+    if (changed == 0) {
+        return 0;
+    }
+    sync_keyboard_keys();
+    return 1;
 }
 
+static int deselect_keyboard_usages(const struct zmk_hid_keyboard_usage_mask *mask) {
+    uint32_t changed = 0;
+    for (int i = 0; i < ZMK_HID_KEYBOARD_USAGE_MASK_WORDS; i++) {
+        changed |= mask->words[i] & keyboard_keys[i];
+        keyboard_keys[i] &= ~mask->words[i];
+    }
+
+    if (changed == 0) {
+        return 0;
+    }
+    sync_keyboard_keys();
+    return 1;
+}
+
+static inline void clear_keyboard_usages() { memset(keyboard_keys, 0, sizeof(keyboard_keys)); }
+
 #elif IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
 
-#define TOGGLE_KEYBOARD(match, val)                                                                \
-    for (int idx = 0; idx < CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE; idx++) {                          \
-        if (keyboard_report.body.keys[idx] != match) {                                             \
-            continue;                                                                              \
-        }                                                                                          \
-        keyboard_report.body.keys[idx] = val;                                                      \
-        if (val) {                                                                                 \
-            break;                                                                                 \
-        }                                                                                          \
+#define SLOT_WORDS DIV_ROUND_UP(CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE, 32)
+
+BUILD_ASSERT(CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE < UINT8_MAX,
+             "CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE must fit the slot index");
+
+// Reverse index of the report, holding the slot of each pressed usage plus one, or 0 if the usage
+// isn't pressed, so presses and releases don't have to scan the report.
+static uint8_t keyboard_slot_by_usage[UINT8_MAX + 1];
+
+// Bitmap of used slots in the report. Usages go into the first empty slot, as hosts may rely on
+// the order of the report.
+static uint32_t keyboard_used_slots[SLOT_WORDS];
+
+static int take_free_slot() {
+    for (int i = 0; i < SLOT_WORDS; i++) {
+        uint32_t free = ~keyboard_used_slots[i];
+        if (i == SLOT_WORDS - 1 && CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE % 32) {
+            free &= BIT_MASK(CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE % 32);
+        }
+        if (free != 0) {
+            int slot = i * 32 + find_lsb_set(free) - 1;
+            WRITE_BIT(keyboard_used_slots[i], slot % 32, true);
+            return slot;
+        }
     }
+    return -ENOMEM;
+}
 
 static inline int select_keyboard_usage(zmk_key_t usage) {
-    TOGGLE_KEYBOARD(0U, usage);
+    if (usage == 0 || usage > UINT8_MAX) {
+        return -EINVAL;
+    }
+    if (keyboard_slot_by_usage[usage] != 0) {
+        return 0;
+    }
+
+    int slot = take_free_slot();
+    if (slot < 0) {
+        return slot;
+    }
+    keyboard_report.body.keys[slot] = usage;
+    keyboard_slot_by_usage[usage] = slot + 1;
     return 0;
 }
 
 static inline int deselect_keyboard_usage(zmk_key_t usage) {
-    TOGGLE_KEYBOARD(usage, 0U);
+    if (usage == 0 || usage > UINT8_MAX) {
+        return -EINVAL;
+    }
+    if (keyboard_slot_by_usage[usage] == 0) {
+        return 0;
+    }
+
+    int slot = keyboard_slot_by_usage[usage] - 1;
+    keyboard_report.body.keys[slot] = 0;
+    keyboard_slot_by_usage[usage] = 0;
+    WRITE_BIT(keyboard_used_slots[slot / 32], slot % 32, false);
     return 0;
 }
 
-static inline int check_keyboard_usage(zmk_key_t usage) {
-    for (int idx = 0; idx < CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE; idx++) {
-        if (keyboard_report.body.keys[idx] == usage) {
-            return true;
+static inline bool check_keyboard_usage(zmk_key_t usage) {
+    return usage != 0 && usage <= UINT8_MAX && keyboard_slot_by_usage[usage] != 0;
+}
+
+static int select_keyboard_usages(const struct zmk_hid_keyboard_usage_mask *mask) {
+    int changed = 0;
+    for (int i = 0; i < ZMK_HID_KEYBOARD_USAGE_MASK_WORDS; i++) {
+        for (uint32_t bits = mask->words[i]; bits != 0; bits &= bits - 1) {
+            zmk_key_t usage = i * 32 + find_lsb_set(bits) - 1;
+            if (usage <= ZMK_HID_KEYBOARD_NKRO_MAX_USAGE && !check_keyboard_usage(usage)) {
+                // The usage is dropped if the report is already full.
+                changed |= select_keyboard_usage(usage) == 0;
+            }
         }
     }
-    return false;
+    return changed;
+}
+
+static int deselect_keyboard_usages(const struct zmk_hid_keyboard_usage_mask *mask) {
+    int changed = 0;
+    for (int i = 0; i < ZMK_HID_KEYBOARD_USAGE_MASK_WORDS; i++) {
+        for (uint32_t bits = mask->words[i]; bits != 0; bits &= bits - 1) {
+            zmk_key_t usage = i * 32 + find_lsb_set(bits) - 1;
+            if (check_keyboard_usage(usage)) {
+                deselect_keyboard_usage(usage);
+                changed = 1;
+            }
+        }
+    }
+    return changed;
+}
+
+static inline void clear_keyboard_usages() {
+    memset(keyboard_slot_by_usage, 0, sizeof(keyboard_slot_by_usage));
+    memset(keyboard_used_slots, 0, sizeof(keyboard_used_slots));
 }
 
 #else
@@ -165,15 +286,58 @@ static inline int check_keyboard_usage(zmk_key_t usage) {
         }                                                                                          \
     }
 
-int zmk_hid_implicit_modifiers_press(zmk_mod_flags_t new_implicit_modifiers) {
+// Usages whose implicit modifiers are currently applied. Pressing a usage with different implicit
+// modifiers replaces them, so all usages in here share the same implicit modifiers, and they stay
+// applied until the last of these usages is released.
+#define IMPLICIT_MODIFIER_USAGES 8
+static uint32_t implicit_modifier_usages[IMPLICIT_MODIFIER_USAGES];
+static uint8_t implicit_modifier_usages_count = 0;
+// Set once more usages share the implicit modifiers than can be tracked. Releasing any usage then
+// clears them, as if none were tracked.
+static bool implicit_modifier_usages_overflow = false;
+
+static int find_implicit_modifier_usage(uint32_t usage) {
+    for (int i = 0; i < implicit_modifier_usages_count; i++) {
+        if (implicit_modifier_usages[i] == usage) {
+            return i;
+        }
+    }
+    return -ENOENT;
+}
+
+int zmk_hid_implicit_modifiers_press(uint32_t usage, zmk_mod_flags_t new_implicit_modifiers) {
+    if (new_implicit_modifiers != implicit_modifiers || implicit_modifier_usages_count == 0) {
+        implicit_modifier_usages_count = 0;
+        implicit_modifier_usages_overflow = false;
+    }
     implicit_modifiers = new_implicit_modifiers;
+
+    if (implicit_modifiers != 0 && find_implicit_modifier_usage(usage) < 0) {
+        if (implicit_modifier_usages_count < IMPLICIT_MODIFIER_USAGES) {
+            implicit_modifier_usages[implicit_modifier_usages_count++] = usage;
+        } else {
+            implicit_modifier_usages_overflow = true;
+        }
+    }
+
     zmk_mod_flags_t current = GET_MODIFIERS;
     SET_MODIFIERS(explicit_modifiers);
     return current == GET_MODIFIERS ? 0 : 1;
 }
 
-int zmk_hid_implicit_modifiers_release() {
-    implicit_modifiers = 0;
+int zmk_hid_implicit_modifiers_release(uint32_t usage) {
+    int idx = find_implicit_modifier_usage(usage);
+    if (idx >= 0) {
+        implicit_modifier_usages[idx] = implicit_modifier_usages[--implicit_modifier_usages_count];
+        if (implicit_modifier_usages_count == 0 && !implicit_modifier_usages_overflow) {
+            implicit_modifiers = 0;
+        }
+    } else if (implicit_modifier_usages_overflow) {
+        implicit_modifiers = 0;
+        implicit_modifier_usages_count = 0;
+        implicit_modifier_usages_overflow = false;
+    }
+
     zmk_mod_flags_t current = GET_MODIFIERS;
     SET_MODIFIERS(explicit_modifiers);
     return current == GET_MODIFIERS ? 0 : 1;
@@ -193,11 +357,21 @@ int zmk_hid_masked_modifiers_clear() {
     return current == GET_MODIFIERS ? 0 : 1;
 }
 
+// Keep track of how often a usage was pressed, like modifiers, so a usage pressed through the
+// keymap and by the string sender at the same time stays pressed until both release it.
+static uint8_t keyboard_usage_counts[UINT8_MAX + 1];
+
 int zmk_hid_keyboard_press(zmk_key_t code) {
     if (code >= HID_USAGE_KEY_KEYBOARD_LEFTCONTROL && code <= HID_USAGE_KEY_KEYBOARD_RIGHT_GUI) {
         return zmk_hid_register_mod(code - HID_USAGE_KEY_KEYBOARD_LEFTCONTROL);
     }
-    select_keyboard_usage(code);
+    if (code > UINT8_MAX) {
+        return 0;
+    }
+    if (keyboard_usage_counts[code] == 0 && select_keyboard_usage(code) != 0) {
+        return 0;
+    }
+    keyboard_usage_counts[code]++;
     return 0;
 };
 
@@ -205,7 +379,12 @@ int zmk_hid_keyboard_release(zmk_key_t code) {
     if (code >= HID_USAGE_KEY_KEYBOARD_LEFTCONTROL && code <= HID_USAGE_KEY_KEYBOARD_RIGHT_GUI) {
         return zmk_hid_unregister_mod(code - HID_USAGE_KEY_KEYBOARD_LEFTCONTROL);
     }
-    deselect_keyboard_usage(code);
+    if (code > UINT8_MAX || keyboard_usage_counts[code] == 0) {
+        return 0;
+    }
+    if (--keyboard_usage_counts[code] == 0) {
+        deselect_keyboard_usage(code);
+    }
     return 0;
 };
 
@@ -216,7 +395,50 @@ bool zmk_hid_keyboard_is_pressed(zmk_key_t code) {
     return check_keyboard_usage(code);
 }
 
-void zmk_hid_keyboard_clear() { memset(&keyboard_report.body, 0, sizeof(keyboard_report.body)); }
+int zmk_hid_keyboard_press_mask(const struct zmk_hid_keyboard_usage_mask *mask) {
+    struct zmk_hid_keyboard_usage_mask selected = {0};
+    for (int i = 0; i < ZMK_HID_KEYBOARD_USAGE_MASK_WORDS; i++) {
+        for (uint32_t bits = mask->words[i]; bits != 0; bits &= bits - 1) {
+            zmk_key_t usage = i * 32 + find_lsb_set(bits) - 1;
+            if (usage <= ZMK_HID_KEYBOARD_NKRO_MAX_USAGE && keyboard_usage_counts[usage] == 0) {
+                zmk_hid_keyboard_usage_mask_add(&selected, usage);
+            }
+        }
+    }
+
+    int changed = select_keyboard_usages(&selected);
+
+    // Usages that didn't fit into a full report aren't counted as pressed.
+    for (int i = 0; i < ZMK_HID_KEYBOARD_USAGE_MASK_WORDS; i++) {
+        for (uint32_t bits = mask->words[i]; bits != 0; bits &= bits - 1) {
+            zmk_key_t usage = i * 32 + find_lsb_set(bits) - 1;
+            if (check_keyboard_usage(usage)) {
+                keyboard_usage_counts[usage]++;
+            }
+        }
+    }
+    return changed;
+}
+
+int zmk_hid_keyboard_release_mask(const struct zmk_hid_keyboard_usage_mask *mask) {
+    struct zmk_hid_keyboard_usage_mask deselected = {0};
+    for (int i = 0; i < ZMK_HID_KEYBOARD_USAGE_MASK_WORDS; i++) {
+        for (uint32_t bits = mask->words[i]; bits != 0; bits &= bits - 1) {
+            zmk_key_t usage = i * 32 + find_lsb_set(bits) - 1;
+            if (usage <= ZMK_HID_KEYBOARD_NKRO_MAX_USAGE && keyboard_usage_counts[usage] > 0 &&
+                --keyboard_usage_counts[usage] == 0) {
+                zmk_hid_keyboard_usage_mask_add(&deselected, usage);
+            }
+        }
+    }
+    return deselect_keyboard_usages(&deselected);
+}
+
+void zmk_hid_keyboard_clear() {
+    clear_keyboard_usages();
+    memset(keyboard_usage_counts, 0, sizeof(keyboard_usage_counts));
+    memset(&keyboard_report.body, 0, sizeof(keyboard_report.body));
+}
 
 int zmk_hid_consumer_press(zmk_key_t code) {
     TOGGLE_CONSUMER(0U, code);
@@ -354,6 +576,42 @@ struct zmk_hid_keyboard_report *zmk_hid_get_keyboard_report() {
     return &keyboard_report;
 }
 
+// Only reads the pressed keys out of the report, so it stays cheap for large NKRO reports that
+// mostly have no keys pressed.
+void zmk_hid_keyboard_report_to_boot(const struct zmk_hid_keyboard_report *report,
+                                     struct zmk_hid_boot_report *boot) {
+    int count = 0;
+
+    memset(boot, 0, sizeof(*boot));
+    boot->modifiers = report->body.modifiers;
+
+    for (int i = 0; i < ARRAY_SIZE(report->body.keys); i++) {
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_NKRO)
+        uint8_t bits = report->body.keys[i];
+        while (bits) {
+            int bit = find_lsb_set(bits) - 1;
+            bits &= ~BIT(bit);
+            if (count == ZMK_HID_BOOT_KEY_LEN) {
+                goto rollover;
+            }
+            boot->keys[count++] = i * 8 + bit;
+        }
+#elif IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+        if (report->body.keys[i] == 0) {
+            continue;
+        }
+        if (count == ZMK_HID_BOOT_KEY_LEN) {
+            goto rollover;
+        }
+        boot->keys[count++] = report->body.keys[i];
+#endif
+    }
+    return;
+
+rollover:
+    memset(boot->keys, HID_USAGE_KEY_KEYBOARD_ERRORROLLOVER, sizeof(boot->keys));
+}
+
 struct zmk_hid_consumer_report *zmk_hid_get_consumer_report() {
     return &consumer_report;
 }
@@ -7,6 +7,8 @@
 #include <zephyr/settings/settings.h>
 #include <zephyr/init.h>
 
+#include <string.h>
+
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
@@ -16,6 +18,7 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #include <zmk/ble.h>
 #include <zmk/hog.h>
+#include <zmk/hog_report_queue.h>
 #include <zmk/hid.h>
 
 enum {
@@ -47,18 +50,18 @@ enum {
 };
 
 static struct hids_report input = {
-    .id = 0x01,
+    .id = ZMK_HID_REPORT_ID_KEYBOARD,
     .type = HIDS_INPUT,
 };
 
 static struct hids_report consumer_input = {
-    .id = 0x02,
+    .id = ZMK_HID_REPORT_ID_CONSUMER,
     .type = HIDS_INPUT,
 };
 
 #if IS_ENABLED(CONFIG_ZMK_MOUSE)
 static struct hids_report mouse_input = {
-    .id = 0x04,
+    .id = ZMK_HID_REPORT_ID_MOUSE,
     .type = HIDS_INPUT,
 };
 #endif
@@ -167,16 +170,11 @@ BT_GATT_SERVICE_DEFINE(
     BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_CTRL_POINT, BT_GATT_CHRC_WRITE_WITHOUT_RESP,
                            BT_GATT_PERM_WRITE, NULL, write_ctrl_point, &ctrl_point));
 
-struct bt_conn *destination_connection() {
-    struct bt_conn *conn;
-    bt_addr_le_t *addr = zmk_ble_active_profile_addr();
-    LOG_DBG("Address pointer %p", addr);
-    if (!bt_addr_le_cmp(addr, BT_ADDR_LE_ANY)) {
-        LOG_WRN("Not sending, no active address for current profile");
-        return NULL;
-    } else if ((conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr)) == NULL) {
+// The connection is looked up once per batch of queued reports rather than for every report.
+static struct bt_conn *destination_connection() {
+    struct bt_conn *conn = zmk_ble_active_profile_conn();
+    if (conn == NULL) {
         LOG_WRN("Not sending, not connected to active profile");
-        return NULL;
     }
 
     return conn;
@@ -186,18 +184,28 @@ K_THREAD_STACK_DEFINE(hog_q_stack, CONFIG_ZMK_BLE_THREAD_STACK_SIZE);
 
 struct k_work_q hog_work_q;
 
-K_MSGQ_DEFINE(zmk_hog_keyboard_msgq, sizeof(struct zmk_hid_keyboard_report_body),
-              CONFIG_ZMK_BLE_KEYBOARD_REPORT_QUEUE_SIZE, 4);
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+#define KEYBOARD_KEYS_OFFSET offsetof(struct zmk_hid_keyboard_report_body, keys)
+#else
+// NKRO keys are a bitmap, compared like the modifiers.
+#define KEYBOARD_KEYS_OFFSET sizeof(struct zmk_hid_keyboard_report_body)
+#endif
+
+ZMK_HOG_REPORT_QUEUE_DEFINE(keyboard_queue, struct zmk_hid_keyboard_report_body,
+                            CONFIG_ZMK_BLE_KEYBOARD_REPORT_QUEUE_SIZE, KEYBOARD_KEYS_OFFSET,
+                            sizeof(((struct zmk_hid_keyboard_report_body *)0)->keys[0]));
 
 void send_keyboard_report_callback(struct k_work *work) {
     struct zmk_hid_keyboard_report_body report;
 
-    while (k_msgq_get(&zmk_hog_keyboard_msgq, &report, K_NO_WAIT) == 0) {
-        struct bt_conn *conn = destination_connection();
-        if (conn == NULL) {
-            return;
-        }
+    struct bt_conn *conn = destination_connection();
+    if (conn == NULL) {
+        // Reports queued for a host that is gone are of no use to the next one.
+        zmk_hog_report_queue_purge(&keyboard_queue);
+        return;
+    }
 
+    while (zmk_hog_report_queue_get(&keyboard_queue, &report)) {
         struct bt_gatt_notify_params notify_params = {
             .attr = &hog_svc.attrs[5],
             .data = &report,
@@ -208,46 +216,43 @@ void send_keyboard_report_callback(struct k_work *work) {
         if (err) {
             LOG_ERR("Error notifying %d", err);
         }
-
-        bt_conn_unref(conn);
     }
+
+    bt_conn_unref(conn);
 }
 
 K_WORK_DEFINE(hog_keyboard_work, send_keyboard_report_callback);
 
 int zmk_hog_send_keyboard_report(struct zmk_hid_keyboard_report_body *report) {
-    int err = k_msgq_put(&zmk_hog_keyboard_msgq, report, K_MSEC(100));
-    if (err) {
-        switch (err) {
-        case -EAGAIN: {
-            LOG_WRN("Keyboard message queue full, popping first message and queueing again");
-            struct zmk_hid_keyboard_report_body discarded_report;
-            k_msgq_get(&zmk_hog_keyboard_msgq, &discarded_report, K_NO_WAIT);
-            return zmk_hog_send_keyboard_report(report);
-        }
-        default:
-            LOG_WRN("Failed to queue keyboard report to send (%d)", err);
-            return err;
-        }
-    }
+    zmk_hog_report_queue_put(&keyboard_queue, report);
 
     k_work_submit_to_queue(&hog_work_q, &hog_keyboard_work);
 
     return 0;
 };
 
-K_MSGQ_DEFINE(zmk_hog_consumer_msgq, sizeof(struct zmk_hid_consumer_report_body),
-              CONFIG_ZMK_BLE_CONSUMER_REPORT_QUEUE_SIZE, 4);
+bool zmk_hog_keyboard_report_queue_has_space(void) {
+    return zmk_hog_report_queue_has_space(&keyboard_queue);
+}
+
+void zmk_hog_get_keyboard_queue_stats(struct zmk_hog_queue_stats *stats) {
+    zmk_hog_report_queue_get_stats(&keyboard_queue, stats);
+}
+
+ZMK_HOG_REPORT_QUEUE_DEFINE(consumer_queue, struct zmk_hid_consumer_report_body,
+                            CONFIG_ZMK_BLE_CONSUMER_REPORT_QUEUE_SIZE, 0,
+                            sizeof(((struct zmk_hid_consumer_report_body *)0)->keys[0]));
 
 void send_consumer_report_callback(struct k_work *work) {
     struct zmk_hid_consumer_report_body report;
 
-    while (k_msgq_get(&zmk_hog_consumer_msgq, &report, K_NO_WAIT) == 0) {
-        struct bt_conn *conn = destination_connection();
-        if (conn == NULL) {
-            return;
-        }
+    struct bt_conn *conn = destination_connection();
+    if (conn == NULL) {
+        zmk_hog_report_queue_purge(&consumer_queue);
+        return;
+    }
 
+    while (zmk_hog_report_queue_get(&consumer_queue, &report)) {
         struct bt_gatt_notify_params notify_params = {
             .attr = &hog_svc.attrs[10],
             .data = &report,
@@ -258,46 +263,43 @@ void send_consumer_report_callback(struct k_work *work) {
         if (err) {
             LOG_DBG("Error notifying %d", err);
         }
-
-        bt_conn_unref(conn);
     }
+
+    bt_conn_unref(conn);
 };
 
 K_WORK_DEFINE(hog_consumer_work, send_consumer_report_callback);
 
 int zmk_hog_send_consumer_report(struct zmk_hid_consumer_report_body *report) {
-    int err = k_msgq_put(&zmk_hog_consumer_msgq, report, K_MSEC(100));
-    if (err) {
-        switch (err) {
-        case -EAGAIN: {
-            LOG_WRN("Consumer message queue full, popping first message and queueing again");
-            struct zmk_hid_consumer_report_body discarded_report;
-            k_msgq_get(&zmk_hog_consumer_msgq, &discarded_report, K_NO_WAIT);
-            return zmk_hog_send_consumer_report(report);
-        }
-        default:
-            LOG_WRN("Failed to queue consumer report to send (%d)", err);
-            return err;
-        }
-    }
+    zmk_hog_report_queue_put(&consumer_queue, report);
 
     k_work_submit_to_queue(&hog_work_q, &hog_consumer_work);
 
     return 0;
 };
 
+bool zmk_hog_consumer_report_queue_has_space(void) {
+    return zmk_hog_report_queue_has_space(&consumer_queue);
+}
+
+void zmk_hog_get_consumer_queue_stats(struct zmk_hog_queue_stats *stats) {
+    zmk_hog_report_queue_get_stats(&consumer_queue, stats);
+}
+
 #if IS_ENABLED(CONFIG_ZMK_MOUSE)
 K_MSGQ_DEFINE(zmk_hog_mouse_msgq, sizeof(struct zmk_hid_mouse_report_body),
               CONFIG_ZMK_BLE_MOUSE_REPORT_QUEUE_SIZE, 4);
 
 void send_mouse_report_callback(struct k_work *work) {
     struct zmk_hid_mouse_report_body report;
-    while (k_msgq_get(&zmk_hog_mouse_msgq, &report, K_NO_WAIT) == 0) {
-        struct bt_conn *conn = destination_connection();
-        if (conn == NULL) {
-            return;
-        }
 
+    struct bt_conn *conn = destination_connection();
+    if (conn == NULL) {
+        k_msgq_purge(&zmk_hog_mouse_msgq);
+        return;
+    }
+
+    while (k_msgq_get(&zmk_hog_mouse_msgq, &report, K_NO_WAIT) == 0) {
         struct bt_gatt_notify_params notify_params = {
             .attr = &hog_svc.attrs[13],
             .data = &report,
@@ -308,9 +310,9 @@ void send_mouse_report_callback(struct k_work *work) {
         if (err) {
             LOG_DBG("Error notifying %d", err);
         }
-
-        bt_conn_unref(conn);
     }
+
+    bt_conn_unref(conn);
 };
 
 K_WORK_DEFINE(hog_mouse_work, send_mouse_report_callback);
@@ -349,12 +351,11 @@ int zmk_hog_send_mouse_report_direct(struct zmk_hid_mouse_report_body *report) {
     int err = bt_gatt_notify_cb(conn, &notify_params);
     if (err) {
         LOG_DBG("Error notifying %d", err);
-        return err;
     }
 
     bt_conn_unref(conn);
 
-    return 0;
+    return err;
 };
 #endif /* IS_ENABLED(CONFIG_ZMK_MOUSE) */
 
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <string.h>
+
+#include <zmk/hog_report_queue.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+static uint8_t *queue_at(struct zmk_hog_report_queue *queue, int index) {
+    return queue->reports + ((queue->head + index) % queue->capacity) * queue->layout.size;
+}
+
+static uint16_t array_usage(const struct zmk_hog_report_layout *layout, const uint8_t *report,
+                            int index) {
+    const uint8_t *elem = report + layout->array_offset + index * layout->array_elem_size;
+    return layout->array_elem_size == 1 ? *elem : sys_get_le16(elem);
+}
+
+static bool array_contains(const struct zmk_hog_report_layout *layout, const uint8_t *report,
+                           uint16_t usage) {
+    int len = (layout->size - layout->array_offset) / layout->array_elem_size;
+    for (int i = 0; i < len; i++) {
+        if (array_usage(layout, report, i) == usage) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Bits are compared one by one. Usages in an array can move between slots, so a usage the report
+// adds has to still be in the next report, and a usage it removes must not come back in it.
+bool zmk_hog_report_can_merge(const struct zmk_hog_report_layout *layout, const uint8_t *prev,
+                              const uint8_t *report, const uint8_t *next) {
+    for (int i = 0; i < layout->array_offset; i++) {
+        if ((prev[i] ^ report[i]) & (report[i] ^ next[i])) {
+            return false;
+        }
+    }
+
+    int len = (layout->size - layout->array_offset) / MAX(layout->array_elem_size, 1);
+    for (int i = 0; i < len; i++) {
+        uint16_t added = array_usage(layout, report, i);
+        if (added != 0 && !array_contains(layout, prev, added) &&
+            !array_contains(layout, next, added)) {
+            return false;
+        }
+
+        uint16_t removed = array_usage(layout, prev, i);
+        if (removed != 0 && !array_contains(layout, report, removed) &&
+            array_contains(layout, next, removed)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool can_merge(struct zmk_hog_report_queue *queue, int index, const uint8_t *next) {
+    const uint8_t *prev = index == 0 ? queue->last_taken : queue_at(queue, index - 1);
+    return zmk_hog_report_can_merge(&queue->layout, prev, queue_at(queue, index), next);
+}
+
+void zmk_hog_report_queue_put(struct zmk_hog_report_queue *queue, const void *report) {
+    k_spinlock_key_t key = k_spin_lock(&queue->lock);
+
+    uint8_t *newest = queue->count > 0 ? queue_at(queue, queue->count - 1) : NULL;
+    if (newest != NULL && memcmp(newest, report, queue->layout.size) == 0) {
+        queue->stats.merged++;
+        k_spin_unlock(&queue->lock, key);
+        return;
+    }
+
+    if (queue->count == queue->capacity) {
+        int index = queue->count - 1;
+
+        // Prefer merging away the newest report, so older ones still go out as they are.
+        while (index >= 0) {
+            const uint8_t *next = index == queue->count - 1 ? report : queue_at(queue, index + 1);
+            if (can_merge(queue, index, next)) {
+                break;
+            }
+            index--;
+        }
+
+        if (index >= 0) {
+            queue->stats.merged++;
+        } else {
+            // Every queued report is a transition the host has to see. Overwriting the newest one
+            // at least leaves the host with the right state in the end.
+            LOG_WRN("HOG report queue full, overwriting the newest report");
+            queue->stats.dropped++;
+            index = queue->count - 1;
+        }
+
+        for (int i = index; i < queue->count - 1; i++) {
+            memcpy(queue_at(queue, i), queue_at(queue, i + 1), queue->layout.size);
+        }
+        queue->count--;
+    }
+
+    memcpy(queue_at(queue, queue->count), report, queue->layout.size);
+    queue->count++;
+
+    k_spin_unlock(&queue->lock, key);
+}
+
+bool zmk_hog_report_queue_get(struct zmk_hog_report_queue *queue, void *report) {
+    k_spinlock_key_t key = k_spin_lock(&queue->lock);
+
+    bool found = queue->count > 0;
+    if (found) {
+        memcpy(report, queue_at(queue, 0), queue->layout.size);
+        memcpy(queue->last_taken, report, queue->layout.size);
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+
+    k_spin_unlock(&queue->lock, key);
+    return found;
+}
+
+void zmk_hog_report_queue_purge(struct zmk_hog_report_queue *queue) {
+    k_spinlock_key_t key = k_spin_lock(&queue->lock);
+    queue->count = 0;
+    memset(queue->last_taken, 0, queue->layout.size);
+    k_spin_unlock(&queue->lock, key);
+}
+
+bool zmk_hog_report_queue_has_space(struct zmk_hog_report_queue *queue) {
+    return queue->count < queue->capacity;
+}
+
+void zmk_hog_report_queue_get_stats(struct zmk_hog_report_queue *queue,
+                                    struct zmk_hog_queue_stats *stats) {
+    k_spinlock_key_t key = k_spin_lock(&queue->lock);
+    *stats = queue->stats;
+    k_spin_unlock(&queue->lock, key);
+}
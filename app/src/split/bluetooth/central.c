@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
 #include <zephyr/types.h>
 #include <zephyr/init.h>
 
@@ -30,7 +31,21 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 static int start_scanning(void);
 
-#define POSITION_STATE_DATA_LEN 16
+#define POSITION_STATE_DATA_LEN ZMK_SPLIT_POS_STATE_LEN
+
+// Most position events held back from a peripheral while its position state is being read.
+#define POSITION_EVENTS_HELD_MAX 8
+
+// Delay before reading the position state of a peripheral again after a read failed.
+#define POSITION_STATE_READ_RETRY_MS 100
+
+// Reads of the peripheral clock per estimate of its offset. The one with the shortest round trip
+// is kept.
+#define CLOCK_SYNC_PROBES 4
+
+// Clocks of the halves may drift apart by up to 50ppm each, which adds uncertainty to an estimate
+// of their offset over time.
+#define CLOCK_SYNC_DRIFT_MS (CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC_INTERVAL / 10000 + 1)
 
 enum peripheral_slot_state {
     PERIPHERAL_SLOT_STATE_OPEN,
@@ -46,8 +61,42 @@ struct peripheral_slot {
     struct bt_gatt_subscribe_params sensor_subscribe_params;
     struct bt_gatt_discover_params sub_discover_params;
     uint16_t run_behavior_handle;
+    uint16_t run_behavior_id_handle;
+    // Behavior labels bound to IDs on the peripheral, indexed by ID, along with their hashes to
+    // speed up lookups.
+    uint32_t behavior_id_hashes[ZMK_SPLIT_BEHAVIOR_IDS_MAX];
+    char behavior_id_labels[ZMK_SPLIT_BEHAVIOR_IDS_MAX][ZMK_SPLIT_RUN_BEHAVIOR_DEV_LEN];
+    uint8_t behavior_ids_count;
+    uint16_t position_state_handle;
     uint8_t position_state[POSITION_STATE_DATA_LEN];
-    uint8_t changed_positions[POSITION_STATE_DATA_LEN];
+    // Sequence number expected for the next position event, once the position state has been read
+    // and position_seeded is set. Until then every event is held back.
+    uint16_t next_position_seq;
+    bool position_seeded;
+    // Set while the position state is read to recover from lost position events, until a read
+    // succeeds. Events received in the meantime are held back and applied on top of the state once
+    // it arrives.
+    bool position_resyncing;
+    // Set when a read failed and has to be started again from the retry work.
+    bool position_read_retry;
+    struct bt_gatt_read_params position_read_params;
+    struct zmk_split_position_event held_position_events[POSITION_EVENTS_HELD_MAX];
+    uint8_t held_position_events_count;
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC)
+    uint16_t clock_handle;
+    struct bt_gatt_read_params clock_read_params;
+    bool clock_probing;
+    uint8_t clock_probes_left;
+    int64_t clock_probe_sent_at;
+    int64_t clock_best_rtt;
+    uint32_t clock_best_offset;
+    // Peripheral uptime minus central uptime in milliseconds, once synced.
+    uint32_t clock_offset;
+    // Round trip of the probe the offset was estimated from, grown by drift since then. An offset
+    // is only replaced by a new estimate that is at least as accurate.
+    int64_t clock_rtt;
+    bool clock_synced;
+#endif
 };
 
 static struct peripheral_slot peripherals[ZMK_SPLIT_BLE_PERIPHERAL_COUNT];
@@ -56,19 +105,164 @@ static bool is_scanning = false;
 
 static const struct bt_uuid_128 split_service_uuid = BT_UUID_INIT_128(ZMK_SPLIT_BT_SERVICE_UUID);
 
-K_MSGQ_DEFINE(peripheral_event_msgq, sizeof(struct zmk_position_state_changed),
+// All positions that changed with one notification from a peripheral, queued as a single item so
+// no number of simultaneous changes can overflow the queue. They are expanded into position events
+// in the work callback.
+struct peripheral_position_diff {
+    uint8_t source;
+    uint8_t changed[POSITION_STATE_DATA_LEN];
+    uint8_t state[POSITION_STATE_DATA_LEN];
+    int64_t timestamp;
+};
+
+K_MSGQ_DEFINE(peripheral_event_msgq, sizeof(struct peripheral_position_diff),
               CONFIG_ZMK_SPLIT_BLE_CENTRAL_POSITION_QUEUE_SIZE, 4);
 
+// An entry per peripheral is kept free for the diff releasing its positions on disconnect, which
+// can't be deferred to a later notification.
+BUILD_ASSERT(CONFIG_ZMK_SPLIT_BLE_CENTRAL_POSITION_QUEUE_SIZE > ZMK_SPLIT_BLE_PERIPHERAL_COUNT,
+             "The peripheral position queue needs room beyond an entry per peripheral");
+
 void peripheral_event_work_callback(struct k_work *work) {
-    struct zmk_position_state_changed ev;
-    while (k_msgq_get(&peripheral_event_msgq, &ev, K_NO_WAIT) == 0) {
-        LOG_DBG("Trigger key position state change for %d", ev.position);
-        ZMK_EVENT_RAISE(new_zmk_position_state_changed(ev));
+    struct peripheral_position_diff diff;
+    while (k_msgq_get(&peripheral_event_msgq, &diff, K_NO_WAIT) == 0) {
+        for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
+            uint8_t changed = diff.changed[i];
+            while (changed) {
+                int j = find_lsb_set(changed) - 1;
+                changed &= ~BIT(j);
+
+                struct zmk_position_state_changed ev = {.source = diff.source,
+                                                        .position = (i * 8) + j,
+                                                        .state = (diff.state[i] & BIT(j)) != 0,
+                                                        .timestamp = diff.timestamp};
+
+                LOG_DBG("Trigger key position state change for %d", ev.position);
+                ZMK_EVENT_RAISE(new_zmk_position_state_changed(ev));
+            }
+        }
     }
 }
 
 K_WORK_DEFINE(peripheral_event_work, peripheral_event_work_callback);
 
+// Queues the changes in the diff and clears it. If the queue is full, the changes are undone in the
+// known position state of the peripheral, so they are raised once the state is learned again, and
+// false is returned. Slots being released may use the entries kept free for them.
+static bool queue_position_diff(struct peripheral_slot *slot,
+                                struct peripheral_position_diff *diff) {
+    bool any_changed = false;
+    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
+        any_changed |= diff->changed[i] != 0;
+    }
+    if (!any_changed) {
+        return true;
+    }
+
+    uint32_t reserved =
+        slot->state == PERIPHERAL_SLOT_STATE_OPEN ? 0 : ZMK_SPLIT_BLE_PERIPHERAL_COUNT;
+    bool queued = k_msgq_num_free_get(&peripheral_event_msgq) > reserved &&
+                  k_msgq_put(&peripheral_event_msgq, diff, K_NO_WAIT) == 0;
+    if (queued) {
+        k_work_submit(&peripheral_event_work);
+    } else {
+        LOG_ERR("Peripheral position queue full, deferring changes from %d", diff->source);
+        // A diff changes each position at most once, so this restores the state before it.
+        for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
+            slot->position_state[i] ^= diff->changed[i];
+        }
+    }
+
+    memset(diff->changed, 0, POSITION_STATE_DATA_LEN);
+    return queued;
+}
+
+// Queues the changes that take the known position state of the peripheral to the given state.
+static bool apply_position_state(struct peripheral_slot *slot, uint8_t source,
+                                 const uint8_t *state) {
+    struct peripheral_position_diff diff = {.source = source, .timestamp = k_uptime_get()};
+
+    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
+        diff.changed[i] = state[i] ^ slot->position_state[i];
+        diff.state[i] = state[i];
+        slot->position_state[i] = state[i];
+    }
+
+    return queue_position_diff(slot, &diff);
+}
+
+// Applies a position event from the peripheral on top of the changes gathered in the diff. Returns
+// false without applying it if events were lost before it, or if the changes before it had to be
+// queued and didn't fit, so the position state has to be read again.
+static bool apply_position_event(struct peripheral_slot *slot,
+                                 struct peripheral_position_diff *diff,
+                                 const struct zmk_split_position_event *ev, int64_t timestamp) {
+    // Without a state to compare with, an event can't be told apart from one already in it.
+    if (!slot->position_seeded) {
+        return false;
+    }
+
+    int16_t seq_delta = ev->seq - slot->next_position_seq;
+    if (seq_delta < 0) {
+        // Already part of the state that was read.
+        return true;
+    } else if (seq_delta > 0) {
+        LOG_WRN("Lost position events from peripheral %d, expected %d but got %d", diff->source,
+                slot->next_position_seq, ev->seq);
+        return false;
+    }
+
+    uint8_t i = ev->position / 8;
+    uint8_t bit = ev->position % 8;
+
+    if (ev->position >= ZMK_KEYMAP_LEN ||
+        !!(slot->position_state[i] & BIT(bit)) == !!ev->state) {
+        slot->next_position_seq++;
+        return true;
+    }
+
+    // A diff holds a single change per position and a single timestamp, so changes that don't fit
+    // in it go in a new one.
+    if ((diff->changed[i] & BIT(bit)) || diff->timestamp != timestamp) {
+        if (!queue_position_diff(slot, diff)) {
+            return false;
+        }
+        diff->timestamp = timestamp;
+    }
+
+    slot->next_position_seq++;
+    WRITE_BIT(slot->position_state[i], bit, ev->state);
+    WRITE_BIT(diff->state[i], bit, ev->state);
+    diff->changed[i] |= BIT(bit);
+
+    return true;
+}
+
+static void hold_position_event(struct peripheral_slot *slot,
+                                const struct zmk_split_position_event *ev) {
+    // Dropped events show up as another gap once the held ones have been applied.
+    if (slot->held_position_events_count < POSITION_EVENTS_HELD_MAX) {
+        slot->held_position_events[slot->held_position_events_count++] = *ev;
+    }
+}
+
+static int64_t position_event_timestamp(const struct peripheral_slot *slot,
+                                        const struct zmk_split_position_event *ev,
+                                        uint32_t newest, int64_t now) {
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC)
+    if (slot->clock_synced) {
+        // How long ago the event happened, going by the peripheral clock. An estimate slightly off
+        // could place the event in the future.
+        int32_t age = (int32_t)((uint32_t)now + slot->clock_offset - ev->timestamp);
+        return now - MAX(age, 0);
+    }
+#endif
+
+    // Without an estimate of the clock offset only the spacing of peripheral timestamps is kept.
+    // The newest event is taken to have just happened.
+    return now - (uint32_t)(newest - ev->timestamp);
+}
+
 int peripheral_slot_index_for_conn(struct bt_conn *conn) {
     for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
         if (peripherals[i].conn == conn) {
@@ -107,30 +301,31 @@ int release_peripheral_slot(int index) {
     }
     slot->state = PERIPHERAL_SLOT_STATE_OPEN;
 
-    // Raise events releasing any active positions from this peripheral
-    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
-        for (int j = 0; j < 8; j++) {
-            if (slot->position_state[i] & BIT(j)) {
-                uint32_t position = (i * 8) + j;
-                struct zmk_position_state_changed ev = {.source = index,
-                                                        .position = position,
-                                                        .state = false,
-                                                        .timestamp = k_uptime_get()};
-
-                k_msgq_put(&peripheral_event_msgq, &ev, K_NO_WAIT);
-                k_work_submit(&peripheral_event_work);
-            }
-        }
+    // Raise events releasing any active positions from this peripheral. Nothing would retry them
+    // once the slot is released, so they go in an entry kept free for it.
+    static const uint8_t released[POSITION_STATE_DATA_LEN] = {0};
+    if (!apply_position_state(slot, index, released)) {
+        LOG_ERR("Failed to release the positions of peripheral %d", index);
     }
 
-    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
-        slot->position_state[i] = 0U;
-        slot->changed_positions[i] = 0U;
-    }
+    slot->next_position_seq = 0;
+    slot->position_seeded = false;
+    slot->position_resyncing = false;
+    slot->position_read_retry = false;
+    slot->held_position_events_count = 0;
+
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC)
+    slot->clock_handle = 0;
+    slot->clock_probing = false;
+    slot->clock_synced = false;
+#endif
 
     // Clean up previously discovered handles;
     slot->subscribe_params.value_handle = 0;
     slot->run_behavior_handle = 0;
+    slot->run_behavior_id_handle = 0;
+    slot->behavior_ids_count = 0;
+    slot->position_state_handle = 0;
 
     return 0;
 }
@@ -232,32 +427,259 @@ static uint8_t split_central_notify_func(struct bt_conn *conn,
 
     LOG_DBG("[NOTIFICATION] data %p length %u", data, length);
 
-    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
-        slot->changed_positions[i] = ((uint8_t *)data)[i] ^ slot->position_state[i];
-        slot->position_state[i] = ((uint8_t *)data)[i];
-        LOG_DBG("data: %d", slot->position_state[i]);
+    // Positions missing from a shorter bitmap are released, and extra ones are ignored.
+    uint8_t state[POSITION_STATE_DATA_LEN] = {0};
+    memcpy(state, data, MIN(length, POSITION_STATE_DATA_LEN));
+
+    // Changes that don't fit in the queue are raised along with the next notification.
+    apply_position_state(slot, peripheral_slot_index_for_conn(conn), state);
+
+    return BT_GATT_ITER_CONTINUE;
+}
+
+static uint8_t split_central_position_state_read_func(struct bt_conn *conn, uint8_t err,
+                                                      struct bt_gatt_read_params *params,
+                                                      const void *data, uint16_t length);
+
+static void split_central_retry_position_state_read(struct peripheral_slot *slot);
+
+static void split_central_resync_position_state(struct bt_conn *conn,
+                                                struct peripheral_slot *slot) {
+    slot->position_resyncing = true;
+    slot->position_read_params.func = split_central_position_state_read_func;
+    slot->position_read_params.handle_count = 1;
+    slot->position_read_params.single.handle = slot->position_state_handle;
+    slot->position_read_params.single.offset = 0;
+
+    int err = bt_gatt_read(conn, &slot->position_read_params);
+    if (err) {
+        LOG_ERR("Failed to read position state (err %d)", err);
+        split_central_retry_position_state_read(slot);
     }
+}
 
-    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
-        for (int j = 0; j < 8; j++) {
-            if (slot->changed_positions[i] & BIT(j)) {
-                uint32_t position = (i * 8) + j;
-                bool pressed = slot->position_state[i] & BIT(j);
-                struct zmk_position_state_changed ev = {.source =
-                                                            peripheral_slot_index_for_conn(conn),
-                                                        .position = position,
-                                                        .state = pressed,
-                                                        .timestamp = k_uptime_get()};
-
-                k_msgq_put(&peripheral_event_msgq, &ev, K_NO_WAIT);
-                k_work_submit(&peripheral_event_work);
-            }
+// Events stay held back while the read is retried, since they can only be applied on top of the
+// state.
+static void split_central_position_state_read_retry_work_callback(struct k_work *work) {
+    for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
+        struct peripheral_slot *slot = &peripherals[i];
+        if (slot->state == PERIPHERAL_SLOT_STATE_CONNECTED && slot->position_read_retry) {
+            slot->position_read_retry = false;
+            split_central_resync_position_state(slot->conn, slot);
+        }
+    }
+}
+
+K_WORK_DELAYABLE_DEFINE(split_central_position_state_read_retry_work,
+                        split_central_position_state_read_retry_work_callback);
+
+static void split_central_retry_position_state_read(struct peripheral_slot *slot) {
+    slot->position_read_retry = true;
+    k_work_schedule(&split_central_position_state_read_retry_work,
+                    K_MSEC(POSITION_STATE_READ_RETRY_MS));
+}
+
+static uint8_t split_central_position_state_read_func(struct bt_conn *conn, uint8_t err,
+                                                      struct bt_gatt_read_params *params,
+                                                      const void *data, uint16_t length) {
+    struct peripheral_slot *slot = peripheral_slot_for_conn(conn);
+    if (slot == NULL || !slot->position_resyncing) {
+        return BT_GATT_ITER_STOP;
+    }
+
+    const size_t state_offset = offsetof(struct zmk_split_position_state, state);
+    if (err || length < state_offset) {
+        LOG_ERR("Failed to read position state (err %d, length %d)", err, length);
+        split_central_retry_position_state_read(slot);
+        return BT_GATT_ITER_STOP;
+    }
+
+    slot->position_resyncing = false;
+
+    struct zmk_split_position_state state = {0};
+    memcpy(&state, data, MIN(length, sizeof(state)));
+
+    uint8_t source = peripheral_slot_index_for_conn(conn);
+    slot->next_position_seq = state.seq + 1;
+    slot->position_seeded = true;
+    if (!apply_position_state(slot, source, state.state)) {
+        // Held events stay held until the next read succeeds.
+        split_central_resync_position_state(conn, slot);
+        return BT_GATT_ITER_STOP;
+    }
+
+    uint8_t count = slot->held_position_events_count;
+    slot->held_position_events_count = 0;
+    if (count == 0) {
+        return BT_GATT_ITER_STOP;
+    }
+
+    struct peripheral_position_diff diff = {.source = source};
+    struct zmk_split_position_event *held = slot->held_position_events;
+    uint32_t newest = held[count - 1].timestamp;
+    int64_t now = k_uptime_get();
+
+    for (int i = 0; i < count; i++) {
+        if (!apply_position_event(slot, &diff, &held[i],
+                                  position_event_timestamp(slot, &held[i], newest, now))) {
+            queue_position_diff(slot, &diff);
+            memmove(held, &held[i], (count - i) * sizeof(held[0]));
+            slot->held_position_events_count = count - i;
+            split_central_resync_position_state(conn, slot);
+            return BT_GATT_ITER_STOP;
+        }
+    }
+
+    if (!queue_position_diff(slot, &diff)) {
+        split_central_resync_position_state(conn, slot);
+    }
+
+    return BT_GATT_ITER_STOP;
+}
+
+static uint8_t split_central_position_events_notify_func(struct bt_conn *conn,
+                                                         struct bt_gatt_subscribe_params *params,
+                                                         const void *data, uint16_t length) {
+    struct peripheral_slot *slot = peripheral_slot_for_conn(conn);
+
+    if (slot == NULL) {
+        LOG_ERR("No peripheral state found for connection");
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    if (!data) {
+        LOG_DBG("[UNSUBSCRIBED]");
+        params->value_handle = 0U;
+        return BT_GATT_ITER_STOP;
+    }
+
+    LOG_DBG("[POSITION EVENTS NOTIFICATION] data %p length %u", data, length);
+
+    const struct zmk_split_position_event *events = data;
+    size_t count = length / sizeof(struct zmk_split_position_event);
+    if (count == 0) {
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    struct peripheral_position_diff diff = {.source = peripheral_slot_index_for_conn(conn)};
+    uint32_t newest = events[count - 1].timestamp;
+    int64_t now = k_uptime_get();
+
+    for (int i = 0; i < count; i++) {
+        if (slot->position_resyncing) {
+            hold_position_event(slot, &events[i]);
+        } else if (!apply_position_event(
+                       slot, &diff, &events[i],
+                       position_event_timestamp(slot, &events[i], newest, now))) {
+            queue_position_diff(slot, &diff);
+            hold_position_event(slot, &events[i]);
+            split_central_resync_position_state(conn, slot);
         }
     }
 
+    if (!queue_position_diff(slot, &diff) && !slot->position_resyncing) {
+        split_central_resync_position_state(conn, slot);
+    }
+
     return BT_GATT_ITER_CONTINUE;
 }
 
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC)
+static uint8_t split_central_clock_read_func(struct bt_conn *conn, uint8_t err,
+                                             struct bt_gatt_read_params *params, const void *data,
+                                             uint16_t length);
+
+static int split_central_send_clock_probe(struct bt_conn *conn, struct peripheral_slot *slot) {
+    slot->clock_read_params.func = split_central_clock_read_func;
+    slot->clock_read_params.handle_count = 1;
+    slot->clock_read_params.single.handle = slot->clock_handle;
+    slot->clock_read_params.single.offset = 0;
+    slot->clock_probe_sent_at = k_uptime_get();
+
+    int err = bt_gatt_read(conn, &slot->clock_read_params);
+    if (err) {
+        LOG_WRN("Failed to read peripheral clock (err %d)", err);
+    }
+    return err;
+}
+
+static uint8_t split_central_clock_read_func(struct bt_conn *conn, uint8_t err,
+                                             struct bt_gatt_read_params *params, const void *data,
+                                             uint16_t length) {
+    int64_t now = k_uptime_get();
+
+    struct peripheral_slot *slot = peripheral_slot_for_conn(conn);
+    if (slot == NULL || !slot->clock_probing) {
+        return BT_GATT_ITER_STOP;
+    }
+
+    if (err || length < sizeof(uint32_t)) {
+        LOG_WRN("Failed to read peripheral clock (err %d, length %d)", err, length);
+        slot->clock_probing = false;
+        return BT_GATT_ITER_STOP;
+    }
+
+    uint32_t peripheral_time;
+    memcpy(&peripheral_time, data, sizeof(peripheral_time));
+
+    // Assume the peripheral read its clock halfway through the round trip, which is off by at most
+    // half the round trip.
+    int64_t rtt = now - slot->clock_probe_sent_at;
+    if (rtt < slot->clock_best_rtt) {
+        slot->clock_best_rtt = rtt;
+        slot->clock_best_offset = peripheral_time - (uint32_t)(slot->clock_probe_sent_at + rtt / 2);
+    }
+
+    if (--slot->clock_probes_left > 0 && split_central_send_clock_probe(conn, slot) == 0) {
+        return BT_GATT_ITER_STOP;
+    }
+
+    slot->clock_probing = false;
+
+    if (slot->clock_synced && slot->clock_best_rtt > slot->clock_rtt) {
+        return BT_GATT_ITER_STOP;
+    }
+
+    LOG_DBG("Peripheral %d clock offset %d ms, round trip %lld ms",
+            peripheral_slot_index_for_conn(conn), slot->clock_best_offset, slot->clock_best_rtt);
+
+    slot->clock_offset = slot->clock_best_offset;
+    slot->clock_rtt = slot->clock_best_rtt;
+    slot->clock_synced = true;
+
+    return BT_GATT_ITER_STOP;
+}
+
+static void split_central_sync_clock(struct bt_conn *conn, struct peripheral_slot *slot) {
+    if (!slot->clock_handle || slot->clock_probing) {
+        return;
+    }
+
+    slot->clock_probing = true;
+    slot->clock_probes_left = CLOCK_SYNC_PROBES;
+    slot->clock_best_rtt = INT64_MAX;
+    slot->clock_rtt += 2 * CLOCK_SYNC_DRIFT_MS;
+
+    if (split_central_send_clock_probe(conn, slot)) {
+        slot->clock_probing = false;
+    }
+}
+
+// The clocks of the halves drift apart slowly, so the offset is estimated again periodically.
+static void split_central_clock_sync_work_callback(struct k_work *work) {
+    for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
+        if (peripherals[i].state == PERIPHERAL_SLOT_STATE_CONNECTED) {
+            split_central_sync_clock(peripherals[i].conn, &peripherals[i]);
+        }
+    }
+
+    k_work_schedule((struct k_work_delayable *)work,
+                    K_MSEC(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC_INTERVAL));
+}
+
+K_WORK_DELAYABLE_DEFINE(split_central_clock_sync_work, split_central_clock_sync_work_callback);
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC) */
+
 static int split_central_subscribe(struct bt_conn *conn, struct bt_gatt_subscribe_params *params) {
     int err = bt_gatt_subscribe(conn, params);
     switch (err) {
@@ -278,8 +700,25 @@ static int split_central_subscribe(struct bt_conn *conn, struct bt_gatt_subscrib
 static uint8_t split_central_chrc_discovery_func(struct bt_conn *conn,
                                                  const struct bt_gatt_attr *attr,
                                                  struct bt_gatt_discover_params *params) {
+    struct peripheral_slot *slot = peripheral_slot_for_conn(conn);
+    if (slot == NULL) {
+        LOG_ERR("No peripheral state found for connection");
+        return BT_GATT_ITER_STOP;
+    }
+
     if (!attr) {
         LOG_DBG("Discover complete");
+
+        // Peripherals running older firmware only notify snapshots of their position state.
+        if (!slot->subscribe_params.value_handle && slot->position_state_handle) {
+            LOG_DBG("No position events characteristic, subscribing to position state");
+            slot->subscribe_params.disc_params = &slot->sub_discover_params;
+            slot->subscribe_params.end_handle = slot->discover_params.end_handle;
+            slot->subscribe_params.value_handle = slot->position_state_handle;
+            slot->subscribe_params.notify = split_central_notify_func;
+            slot->subscribe_params.value = BT_GATT_CCC_NOTIFY;
+            split_central_subscribe(conn, &slot->subscribe_params);
+        }
         return BT_GATT_ITER_STOP;
     }
 
@@ -288,12 +727,6 @@ static uint8_t split_central_chrc_discovery_func(struct bt_conn *conn,
         return BT_GATT_ITER_STOP;
     }
 
-    struct peripheral_slot *slot = peripheral_slot_for_conn(conn);
-    if (slot == NULL) {
-        LOG_ERR("No peripheral state found for connection");
-        return BT_GATT_ITER_STOP;
-    }
-
     LOG_DBG("[ATTRIBUTE] handle %u", attr->handle);
     const struct bt_uuid *chrc_uuid = ((struct bt_gatt_chrc *)attr->user_data)->uuid;
 
@@ -302,13 +735,32 @@ static uint8_t split_central_chrc_discovery_func(struct bt_conn *conn,
         slot->discover_params.uuid = NULL;
         slot->discover_params.start_handle = attr->handle + 2;
         slot->discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+        slot->position_state_handle = bt_gatt_attr_value_handle(attr);
+    } else if (bt_uuid_cmp(chrc_uuid,
+                           BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_POSITION_EVENTS_UUID)) == 0 &&
+               slot->position_state_handle) {
+        LOG_DBG("Found position events characteristic");
+        slot->discover_params.uuid = NULL;
+        slot->discover_params.start_handle = attr->handle + 2;
+        slot->discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
 
         slot->subscribe_params.disc_params = &slot->sub_discover_params;
         slot->subscribe_params.end_handle = slot->discover_params.end_handle;
         slot->subscribe_params.value_handle = bt_gatt_attr_value_handle(attr);
-        slot->subscribe_params.notify = split_central_notify_func;
+        slot->subscribe_params.notify = split_central_position_events_notify_func;
         slot->subscribe_params.value = BT_GATT_CCC_NOTIFY;
         split_central_subscribe(conn, &slot->subscribe_params);
+
+        // Events only describe changes, so start from the current state of the peripheral.
+        split_central_resync_position_state(conn, slot);
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC)
+    } else if (bt_uuid_cmp(chrc_uuid, BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_CLOCK_UUID)) == 0) {
+        LOG_DBG("Found clock characteristic");
+        slot->discover_params.uuid = NULL;
+        slot->discover_params.start_handle = attr->handle + 2;
+        slot->clock_handle = bt_gatt_attr_value_handle(attr);
+        split_central_sync_clock(conn, slot);
+#endif
 #if ZMK_KEYMAP_HAS_SENSORS
     } else if (bt_uuid_cmp(chrc_uuid, BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_SENSOR_STATE_UUID)) ==
                0) {
@@ -329,12 +781,22 @@ static uint8_t split_central_chrc_discovery_func(struct bt_conn *conn,
         slot->discover_params.uuid = NULL;
         slot->discover_params.start_handle = attr->handle + 2;
         slot->run_behavior_handle = bt_gatt_attr_value_handle(attr);
+    } else if (bt_uuid_cmp(chrc_uuid,
+                           BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_RUN_BEHAVIOR_ID_UUID)) == 0) {
+        LOG_DBG("Found run behavior ID handle");
+        slot->discover_params.uuid = NULL;
+        slot->discover_params.start_handle = attr->handle + 2;
+        slot->run_behavior_id_handle = bt_gatt_attr_value_handle(attr);
     }
 
-    bool subscribed = slot->run_behavior_handle && slot->subscribe_params.value_handle;
+    bool subscribed = slot->run_behavior_handle && slot->run_behavior_id_handle &&
+                      slot->subscribe_params.value_handle;
 #if ZMK_KEYMAP_HAS_SENSORS
     subscribed = subscribed && slot->sensor_subscribe_params.value_handle;
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC)
+    subscribed = subscribed && slot->clock_handle;
+#endif
 
     return subscribed ? BT_GATT_ITER_STOP : BT_GATT_ITER_CONTINUE;
 }
@@ -614,26 +1076,77 @@ K_MSGQ_DEFINE(zmk_split_central_split_run_msgq,
               sizeof(struct zmk_split_run_behavior_payload_wrapper),
               CONFIG_ZMK_SPLIT_BLE_CENTRAL_SPLIT_RUN_QUEUE_SIZE, 4);
 
+static uint32_t behavior_label_hash(const char *label) {
+    // 32 bit FNV-1a
+    uint32_t hash = 2166136261U;
+    for (; *label != '\0'; label++) {
+        hash = (hash ^ (uint8_t)*label) * 16777619U;
+    }
+    return hash;
+}
+
+// Runs the behavior through its ID on the peripheral, binding the next free ID to its label the
+// first time it is run on the connection.
+static int split_central_write_behavior_id(struct peripheral_slot *slot,
+                                           const struct zmk_split_run_behavior_payload *payload) {
+    struct zmk_split_run_behavior_id_payload id_payload = {.data = payload->data};
+    size_t len = offsetof(struct zmk_split_run_behavior_id_payload, behavior_dev);
+    uint32_t hash = behavior_label_hash(payload->behavior_dev);
+
+    for (int i = 0; i < slot->behavior_ids_count; i++) {
+        if (slot->behavior_id_hashes[i] == hash &&
+            strcmp(slot->behavior_id_labels[i], payload->behavior_dev) == 0) {
+            id_payload.behavior_id = i;
+            return bt_gatt_write_without_response(slot->conn, slot->run_behavior_id_handle,
+                                                  &id_payload, len, true);
+        }
+    }
+
+    id_payload.behavior_id = slot->behavior_ids_count < ZMK_SPLIT_BEHAVIOR_IDS_MAX
+                                 ? slot->behavior_ids_count
+                                 : ZMK_SPLIT_BEHAVIOR_ID_NONE;
+    strlcpy(id_payload.behavior_dev, payload->behavior_dev, sizeof(id_payload.behavior_dev));
+    len += strlen(id_payload.behavior_dev) + 1;
+
+    int err = bt_gatt_write_without_response(slot->conn, slot->run_behavior_id_handle, &id_payload,
+                                             len, true);
+    if (err == 0 && id_payload.behavior_id != ZMK_SPLIT_BEHAVIOR_ID_NONE) {
+        slot->behavior_id_hashes[id_payload.behavior_id] = hash;
+        strlcpy(slot->behavior_id_labels[id_payload.behavior_id], id_payload.behavior_dev,
+                ZMK_SPLIT_RUN_BEHAVIOR_DEV_LEN);
+        slot->behavior_ids_count++;
+    }
+
+    return err;
+}
+
 void split_central_split_run_callback(struct k_work *work) {
     struct zmk_split_run_behavior_payload_wrapper payload_wrapper;
 
     LOG_DBG("");
 
     while (k_msgq_get(&zmk_split_central_split_run_msgq, &payload_wrapper, K_NO_WAIT) == 0) {
-        if (peripherals[payload_wrapper.source].state != PERIPHERAL_SLOT_STATE_CONNECTED) {
+        struct peripheral_slot *slot = &peripherals[payload_wrapper.source];
+
+        if (slot->state != PERIPHERAL_SLOT_STATE_CONNECTED) {
             LOG_ERR("Source not connected");
             continue;
         }
-        if (!peripherals[payload_wrapper.source].run_behavior_handle) {
+
+        int err;
+        if (slot->run_behavior_id_handle) {
+            err = split_central_write_behavior_id(slot, &payload_wrapper.payload);
+        } else if (slot->run_behavior_handle) {
+            // Peripherals running older firmware only take behavior labels.
+            err = bt_gatt_write_without_response(slot->conn, slot->run_behavior_handle,
+                                                 &payload_wrapper.payload,
+                                                 sizeof(struct zmk_split_run_behavior_payload),
+                                                 true);
+        } else {
             LOG_ERR("Run behavior handle not found");
             continue;
         }
 
-        int err = bt_gatt_write_without_response(
-            peripherals[payload_wrapper.source].conn,
-            peripherals[payload_wrapper.source].run_behavior_handle, &payload_wrapper.payload,
-            sizeof(struct zmk_split_run_behavior_payload), true);
-
         if (err) {
             LOG_ERR("Failed to write the behavior characteristic (err %d)", err);
         }
@@ -691,6 +1204,11 @@ int zmk_split_bt_central_init(const struct device *_arg) {
                        CONFIG_ZMK_BLE_THREAD_PRIORITY, NULL);
     bt_conn_cb_register(&conn_callbacks);
 
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC)
+    k_work_schedule(&split_central_clock_sync_work,
+                    K_MSEC(CONFIG_ZMK_SPLIT_BLE_CENTRAL_CLOCK_SYNC_INTERVAL));
+#endif
+
     return IS_ENABLED(CONFIG_ZMK_BLE_CLEAR_BONDS_ON_START) ? 0 : start_scanning();
 }
 
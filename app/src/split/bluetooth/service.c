@@ -4,10 +4,12 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <zephyr/device.h>
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/types.h>
 #include <zephyr/sys/util.h>
 #include <zephyr/init.h>
+#include <zephyr/spinlock.h>
 
 #include <zephyr/logging/log.h>
 
@@ -21,7 +23,9 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #include <zmk/matrix.h>
 #include <zmk/split/bluetooth/uuid.h>
 #include <zmk/split/bluetooth/service.h>
+#include <zmk/event_manager.h>
 #include <zmk/events/sensor_event.h>
+#include <zmk/events/split_peripheral_status_changed.h>
 #include <zmk/sensors.h>
 
 #if ZMK_KEYMAP_HAS_SENSORS
@@ -38,17 +42,59 @@ static void split_svc_sensor_state_ccc(const struct bt_gatt_attr *attr, uint16_t
 }
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
 
-#define POS_STATE_LEN 16
+#define POS_STATE_LEN ZMK_SPLIT_POS_STATE_LEN
+
+// Centrals running older firmware read 16 bytes from every position state notification.
+#define LEGACY_POS_STATE_LEN MAX(POS_STATE_LEN, 16)
+
+BUILD_ASSERT(ZMK_KEYMAP_LEN <= UINT8_MAX + 1, "Split position events carry 8 bit positions");
+
+// Most position events that are packed into one notification, when the MTU allows it.
+#define POS_EVENTS_PER_NOTIFY_MAX 16
 
 static uint8_t num_of_positions = ZMK_KEYMAP_LEN;
-static uint8_t position_state[POS_STATE_LEN];
+
+// Protects the position state and sequence number, which are read from the Bluetooth thread, and
+// legacy_state_stale.
+static struct k_spinlock position_lock;
+static struct zmk_split_position_state position_state;
+// Set when a position event is dropped before the legacy snapshot caught up with it.
+static bool legacy_state_stale;
 
 static struct zmk_split_run_behavior_payload behavior_run_payload;
 
 static ssize_t split_svc_pos_state(struct bt_conn *conn, const struct bt_gatt_attr *attrs,
                                    void *buf, uint16_t len, uint16_t offset) {
-    return bt_gatt_attr_read(conn, attrs, buf, len, offset, &position_state,
-                             sizeof(position_state));
+    struct zmk_split_position_state state;
+
+    k_spinlock_key_t key = k_spin_lock(&position_lock);
+    state = position_state;
+    k_spin_unlock(&position_lock, key);
+
+    return bt_gatt_attr_read(conn, attrs, buf, len, offset, &state, sizeof(state));
+}
+
+static void split_svc_invoke_behavior(const char *behavior_dev,
+                                      const struct zmk_split_run_behavior_data *data) {
+    struct zmk_behavior_binding binding = {
+        .param1 = data->param1,
+        .param2 = data->param2,
+        .behavior_dev = (char *)behavior_dev,
+    };
+    LOG_DBG("%s with params %d %d: pressed? %d", binding.behavior_dev, binding.param1,
+            binding.param2, data->state);
+    struct zmk_behavior_binding_event event = {.position = data->position,
+                                               .timestamp = k_uptime_get()};
+    int err;
+    if (data->state > 0) {
+        err = behavior_keymap_binding_pressed(&binding, event);
+    } else {
+        err = behavior_keymap_binding_released(&binding, event);
+    }
+
+    if (err) {
+        LOG_ERR("Failed to invoke behavior %s: %d", binding.behavior_dev, err);
+    }
 }
 
 static ssize_t split_svc_run_behavior(struct bt_conn *conn, const struct bt_gatt_attr *attrs,
@@ -63,7 +109,7 @@ static ssize_t split_svc_run_behavior(struct bt_conn *conn, const struct bt_gatt
         return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
     }
 
-    memcpy(payload + offset, buf, len);
+    memcpy((uint8_t *)payload + offset, buf, len);
 
     // We run if:
     // 1: We've gotten all the position/state/param data.
@@ -72,27 +118,69 @@ static ssize_t split_svc_run_behavior(struct bt_conn *conn, const struct bt_gatt
         offsetof(struct zmk_split_run_behavior_payload, behavior_dev);
     if ((end_addr > sizeof(struct zmk_split_run_behavior_data)) &&
         payload->behavior_dev[end_addr - behavior_dev_offset - 1] == '\0') {
-        struct zmk_behavior_binding binding = {
-            .param1 = payload->data.param1,
-            .param2 = payload->data.param2,
-            .behavior_dev = payload->behavior_dev,
-        };
-        LOG_DBG("%s with params %d %d: pressed? %d", binding.behavior_dev, binding.param1,
-                binding.param2, payload->data.state);
-        struct zmk_behavior_binding_event event = {.position = payload->data.position,
-                                                   .timestamp = k_uptime_get()};
-        int err;
-        if (payload->data.state > 0) {
-            err = behavior_keymap_binding_pressed(&binding, event);
-        } else {
-            err = behavior_keymap_binding_released(&binding, event);
+        split_svc_invoke_behavior(payload->behavior_dev, &payload->data);
+    }
+
+    return len;
+}
+
+// Names of the behavior devices bound to each ID. device_get_binding matches these by pointer
+// before falling back to comparing strings. IDs are only valid for the connection that bound them.
+static const char *behavior_ids[ZMK_SPLIT_BEHAVIOR_IDS_MAX];
+
+static int split_svc_behavior_ids_listener(const zmk_event_t *eh) {
+    memset(behavior_ids, 0, sizeof(behavior_ids));
+    return ZMK_EV_EVENT_BUBBLE;
+}
+
+ZMK_LISTENER(split_svc_behavior_ids, split_svc_behavior_ids_listener);
+ZMK_SUBSCRIPTION(split_svc_behavior_ids, zmk_split_peripheral_status_changed);
+
+static ssize_t split_svc_run_behavior_id(struct bt_conn *conn, const struct bt_gatt_attr *attrs,
+                                         const void *buf, uint16_t len, uint16_t offset,
+                                         uint8_t flags) {
+    struct zmk_split_run_behavior_id_payload payload = {0};
+    const size_t behavior_dev_offset =
+        offsetof(struct zmk_split_run_behavior_id_payload, behavior_dev);
+
+    if (offset != 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+    if (len < behavior_dev_offset || len > sizeof(payload)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    memcpy(&payload, buf, len);
+
+    const char *behavior_dev;
+    if (len > behavior_dev_offset) {
+        payload.behavior_dev[ZMK_SPLIT_RUN_BEHAVIOR_DEV_LEN - 1] = '\0';
+
+        const struct device *dev = device_get_binding(payload.behavior_dev);
+        if (dev == NULL) {
+            LOG_ERR("Unknown behavior %s", payload.behavior_dev);
+            // Later writes with this ID must not run the behavior bound to it before.
+            if (payload.behavior_id < ZMK_SPLIT_BEHAVIOR_IDS_MAX) {
+                behavior_ids[payload.behavior_id] = NULL;
+            }
+            return len;
         }
+        behavior_dev = dev->name;
 
-        if (err) {
-            LOG_ERR("Failed to invoke behavior %s: %d", binding.behavior_dev, err);
+        if (payload.behavior_id < ZMK_SPLIT_BEHAVIOR_IDS_MAX) {
+            LOG_DBG("Bound behavior ID %d to %s", payload.behavior_id, behavior_dev);
+            behavior_ids[payload.behavior_id] = behavior_dev;
         }
+    } else if (payload.behavior_id < ZMK_SPLIT_BEHAVIOR_IDS_MAX &&
+               behavior_ids[payload.behavior_id] != NULL) {
+        behavior_dev = behavior_ids[payload.behavior_id];
+    } else {
+        LOG_ERR("Unknown behavior ID %d", payload.behavior_id);
+        return len;
     }
 
+    split_svc_invoke_behavior(behavior_dev, &payload.data);
+
     return len;
 }
 
@@ -105,6 +193,18 @@ static void split_svc_pos_state_ccc(const struct bt_gatt_attr *attr, uint16_t va
     LOG_DBG("value %d", value);
 }
 
+static void split_svc_pos_events_ccc(const struct bt_gatt_attr *attr, uint16_t value) {
+    LOG_DBG("value %d", value);
+}
+
+// Lets the central estimate the offset between the clocks of the halves, so it can translate the
+// timestamps of position events.
+static ssize_t split_svc_clock(struct bt_conn *conn, const struct bt_gatt_attr *attrs, void *buf,
+                               uint16_t len, uint16_t offset) {
+    uint32_t now = k_uptime_get_32();
+    return bt_gatt_attr_read(conn, attrs, buf, len, offset, &now, sizeof(now));
+}
+
 BT_GATT_SERVICE_DEFINE(
     split_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_SERVICE_UUID)),
     BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_POSITION_STATE_UUID),
@@ -122,40 +222,95 @@ BT_GATT_SERVICE_DEFINE(
                            split_svc_sensor_state, NULL, &last_sensor_event),
     BT_GATT_CCC(split_svc_sensor_state_ccc, BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
+    BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_POSITION_EVENTS_UUID),
+                           BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_NONE, NULL, NULL, NULL),
+    BT_GATT_CCC(split_svc_pos_events_ccc, BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+    BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_CLOCK_UUID), BT_GATT_CHRC_READ,
+                           BT_GATT_PERM_READ_ENCRYPT, split_svc_clock, NULL, NULL),
+    BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_RUN_BEHAVIOR_ID_UUID),
+                           BT_GATT_CHRC_WRITE_WITHOUT_RESP, BT_GATT_PERM_WRITE_ENCRYPT, NULL,
+                           split_svc_run_behavior_id, NULL),
 );
 
 K_THREAD_STACK_DEFINE(service_q_stack, CONFIG_ZMK_SPLIT_BLE_PERIPHERAL_STACK_SIZE);
 
 struct k_work_q service_work_q;
 
-K_MSGQ_DEFINE(position_state_msgq, sizeof(char[POS_STATE_LEN]),
+K_MSGQ_DEFINE(position_event_msgq, sizeof(struct zmk_split_position_event),
               CONFIG_ZMK_SPLIT_BLE_PERIPHERAL_POSITION_QUEUE_SIZE, 4);
 
+static void min_mtu_cb(struct bt_conn *conn, void *data) {
+    uint16_t *mtu = data;
+    *mtu = MIN(*mtu, bt_gatt_get_mtu(conn));
+}
+
+// Centrals that subscribe to the position events characteristic get every press and release in
+// order, packed into as few notifications as the MTU allows, and use the sequence numbers to notice
+// lost events. Centrals that only know the position state characteristic get one snapshot of the
+// state after each event, as before.
 void send_position_state_callback(struct k_work *work) {
-    uint8_t state[POS_STATE_LEN];
+    static struct zmk_split_position_event events[POS_EVENTS_PER_NOTIFY_MAX];
+    static uint8_t legacy_state[LEGACY_POS_STATE_LEN];
+
+    const struct bt_gatt_attr *events_attr =
+        bt_gatt_find_by_uuid(split_svc.attrs, split_svc.attr_count,
+                             BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_POSITION_EVENTS_UUID));
+
+    uint16_t mtu = UINT16_MAX;
+    bt_conn_foreach(BT_CONN_TYPE_LE, min_mtu_cb, &mtu);
+    // Subtract the ATT notification header.
+    size_t max_count = CLAMP((MAX(mtu, 3) - 3) / sizeof(struct zmk_split_position_event), 1,
+                             POS_EVENTS_PER_NOTIFY_MAX);
+
+    size_t count = 0;
+    while (count < max_count && k_msgq_get(&position_event_msgq, &events[count], K_NO_WAIT) == 0) {
+        const struct zmk_split_position_event *ev = &events[count++];
+
+        // Replaying the events gives legacy centrals one snapshot per change. Events dropped from a
+        // full queue never get here, so the snapshot starts over from the position state then.
+        k_spinlock_key_t key = k_spin_lock(&position_lock);
+        if (legacy_state_stale) {
+            memcpy(legacy_state, position_state.state, sizeof(position_state.state));
+            legacy_state_stale = false;
+        }
+        k_spin_unlock(&position_lock, key);
 
-    while (k_msgq_get(&position_state_msgq, &state, K_NO_WAIT) == 0) {
-        int err = bt_gatt_notify(NULL, &split_svc.attrs[1], &state, sizeof(state));
+        WRITE_BIT(legacy_state[ev->position / 8], ev->position % 8, ev->state);
+        int err = bt_gatt_notify(NULL, &split_svc.attrs[1], legacy_state, sizeof(legacy_state));
         if (err) {
             LOG_DBG("Error notifying %d", err);
         }
+
+        if (count == max_count || k_msgq_num_used_get(&position_event_msgq) == 0) {
+            err = bt_gatt_notify(NULL, events_attr, events,
+                                 count * sizeof(struct zmk_split_position_event));
+            if (err) {
+                LOG_DBG("Error notifying %d", err);
+            }
+            count = 0;
+        }
     }
 };
 
 K_WORK_DEFINE(service_position_notify_work, send_position_state_callback);
 
-int send_position_state() {
-    int err = k_msgq_put(&position_state_msgq, position_state, K_MSEC(100));
+static int send_position_event(struct zmk_split_position_event ev) {
+    int err = k_msgq_put(&position_event_msgq, &ev, K_MSEC(100));
     if (err) {
         switch (err) {
         case -EAGAIN: {
-            LOG_WRN("Position state message queue full, popping first message and queueing again");
-            uint8_t discarded_state[POS_STATE_LEN];
-            k_msgq_get(&position_state_msgq, &discarded_state, K_NO_WAIT);
-            return send_position_state();
+            // The central notices the gap in sequence numbers and reads the position state.
+            LOG_WRN("Position event message queue full, popping first message and queueing again");
+            struct zmk_split_position_event discarded_event;
+            k_msgq_get(&position_event_msgq, &discarded_event, K_NO_WAIT);
+
+            k_spinlock_key_t key = k_spin_lock(&position_lock);
+            legacy_state_stale = true;
+            k_spin_unlock(&position_lock, key);
+            return send_position_event(ev);
         }
         default:
-            LOG_WRN("Failed to queue position state to send (%d)", err);
+            LOG_WRN("Failed to queue position event to send (%d)", err);
             return err;
         }
     }
@@ -165,14 +320,28 @@ int send_position_state() {
     return 0;
 }
 
-int zmk_split_bt_position_pressed(uint8_t position) {
-    WRITE_BIT(position_state[position / 8], position % 8, true);
-    return send_position_state();
+static int update_position_state(uint8_t position, bool pressed, int64_t timestamp) {
+    if (position >= ZMK_KEYMAP_LEN) {
+        return -EINVAL;
+    }
+
+    struct zmk_split_position_event ev = {
+        .position = position, .state = pressed, .timestamp = (uint32_t)timestamp};
+
+    k_spinlock_key_t key = k_spin_lock(&position_lock);
+    WRITE_BIT(position_state.state[position / 8], position % 8, pressed);
+    ev.seq = ++position_state.seq;
+    k_spin_unlock(&position_lock, key);
+
+    return send_position_event(ev);
+}
+
+int zmk_split_bt_position_pressed(uint8_t position, int64_t timestamp) {
+    return update_position_state(position, true, timestamp);
 }
 
-int zmk_split_bt_position_released(uint8_t position) {
-    WRITE_BIT(position_state[position / 8], position % 8, false);
-    return send_position_state();
+int zmk_split_bt_position_released(uint8_t position, int64_t timestamp) {
+    return update_position_state(position, false, timestamp);
 }
 
 #if ZMK_KEYMAP_HAS_SENSORS
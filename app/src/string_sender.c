@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+
+#include <dt-bindings/zmk/hid_usage_pages.h>
+#include <dt-bindings/zmk/keys.h>
+#include <dt-bindings/zmk/modifiers.h>
+#include <zmk/endpoints.h>
+#include <zmk/hid.h>
+#include <zmk/string_sender.h>
+#include <zmk/timer_wheel.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// How long to wait before checking again whether the endpoint can take another report.
+#define STRING_SENDER_RETRY_MS 1
+
+// Key codes, including implicit modifiers, that type each ASCII character on a US layout.
+static const uint32_t ascii_keys[128] = {
+    ['\t'] = TAB,   ['\n'] = RET,  [' '] = SPACE, ['!'] = EXCL,  ['"'] = DQT,   ['#'] = HASH,
+    ['$'] = DLLR,   ['%'] = PRCNT, ['&'] = AMPS,  ['\''] = SQT,  ['('] = LPAR,  [')'] = RPAR,
+    ['*'] = STAR,   ['+'] = PLUS,  [','] = COMMA, ['-'] = MINUS, ['.'] = DOT,   ['/'] = FSLH,
+    ['0'] = N0,     ['1'] = N1,    ['2'] = N2,    ['3'] = N3,    ['4'] = N4,    ['5'] = N5,
+    ['6'] = N6,     ['7'] = N7,    ['8'] = N8,    ['9'] = N9,    [':'] = COLON, [';'] = SEMI,
+    ['<'] = LT,     ['='] = EQUAL, ['>'] = GT,    ['?'] = QMARK, ['@'] = AT,    ['A'] = LS(A),
+    ['B'] = LS(B),  ['C'] = LS(C), ['D'] = LS(D), ['E'] = LS(E), ['F'] = LS(F), ['G'] = LS(G),
+    ['H'] = LS(H),  ['I'] = LS(I), ['J'] = LS(J), ['K'] = LS(K), ['L'] = LS(L), ['M'] = LS(M),
+    ['N'] = LS(N),  ['O'] = LS(O), ['P'] = LS(P), ['Q'] = LS(Q), ['R'] = LS(R), ['S'] = LS(S),
+    ['T'] = LS(T),  ['U'] = LS(U), ['V'] = LS(V), ['W'] = LS(W), ['X'] = LS(X), ['Y'] = LS(Y),
+    ['Z'] = LS(Z),  ['['] = LBKT,  ['\\'] = BSLH, [']'] = RBKT,  ['^'] = CARET, ['_'] = UNDER,
+    ['`'] = GRAVE,  ['a'] = A,     ['b'] = B,     ['c'] = C,     ['d'] = D,     ['e'] = E,
+    ['f'] = F,      ['g'] = G,     ['h'] = H,     ['i'] = I,     ['j'] = J,     ['k'] = K,
+    ['l'] = L,      ['m'] = M,     ['n'] = N,     ['o'] = O,     ['p'] = P,     ['q'] = Q,
+    ['r'] = R,      ['s'] = S,     ['t'] = T,     ['u'] = U,     ['v'] = V,     ['w'] = W,
+    ['x'] = X,      ['y'] = Y,     ['z'] = Z,     ['{'] = LBRC,  ['|'] = PIPE,  ['}'] = RBRC,
+    ['~'] = TILDE,
+};
+
+// Most keys pressed together in one report. Hosts can't tell the order of keys that go down in the
+// same report, so only characters with ascending usages are packed, which is the order both the
+// NKRO bitmap and the slots of a freshly filled HKRO report list them in. NKRO reports pack as many
+// keys as a boot keyboard report holds.
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+#define STRING_SENDER_KEYS_MAX CONFIG_ZMK_HID_KEYBOARD_REPORT_SIZE
+#else
+#define STRING_SENDER_KEYS_MAX 6
+#endif
+
+static const char *pending[CONFIG_ZMK_STRING_SENDER_QUEUE_SIZE];
+static uint8_t pending_head;
+static uint8_t pending_count;
+
+// Next character of the text being typed out, or NULL when idle.
+static const char *cursor;
+
+// Key codes left pressed in the keyboard report by the last report, which all share the same
+// implicit modifiers. Keyboard usages are counted, so releasing these leaves the same keys pressed
+// if they are held through the keymap as well.
+static uint32_t held_keys[STRING_SENDER_KEYS_MAX];
+static uint8_t held_count;
+static struct zmk_hid_keyboard_usage_mask held_mask;
+
+static struct zmk_timer retry_timer;
+
+static void string_sender_press(uint32_t key) {
+    LOG_DBG("usage 0x%02X implicit_mods 0x%02X", ZMK_HID_USAGE_ID(key), SELECT_MODS(key));
+
+    zmk_hid_implicit_modifiers_press(STRIP_MODS(key), SELECT_MODS(key));
+    zmk_hid_keyboard_usage_mask_add(&held_mask, ZMK_HID_USAGE_ID(key));
+    held_keys[held_count++] = key;
+}
+
+static void string_sender_release(void) {
+    if (held_count == 0) {
+        return;
+    }
+
+    zmk_hid_keyboard_release_mask(&held_mask);
+
+    for (int i = 0; i < held_count; i++) {
+        uint32_t key = held_keys[i];
+        LOG_DBG("usage 0x%02X implicit_mods 0x%02X", ZMK_HID_USAGE_ID(key), SELECT_MODS(key));
+
+        // A key still held through the keymap keeps its implicit modifiers.
+        if (!zmk_hid_keyboard_is_pressed(ZMK_HID_USAGE_ID(key))) {
+            zmk_hid_implicit_modifiers_release(STRIP_MODS(key));
+        }
+    }
+
+    held_mask = (struct zmk_hid_keyboard_usage_mask){0};
+    held_count = 0;
+}
+
+static bool is_held(uint32_t key) {
+    for (int i = 0; i < held_count; i++) {
+        if (ZMK_HID_USAGE_ID(held_keys[i]) == ZMK_HID_USAGE_ID(key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t ascii_key(uint8_t c) { return c < ARRAY_SIZE(ascii_keys) ? ascii_keys[c] : 0; }
+
+// Returns the key code for the character at the cursor, skipping characters that can't be typed,
+// or 0 once the end of the text is reached.
+static uint32_t next_key(void) {
+    for (; *cursor != '\0'; cursor++) {
+        uint32_t key = ascii_key(*cursor);
+        if (key != 0) {
+            return key;
+        }
+        LOG_WRN("Unable to type character 0x%02X", (uint8_t)*cursor);
+    }
+    return 0;
+}
+
+static const char *next_text(void) {
+    if (pending_count == 0) {
+        return NULL;
+    }
+
+    const char *text = pending[pending_head];
+    pending_head = (pending_head + 1) % CONFIG_ZMK_STRING_SENDER_QUEUE_SIZE;
+    pending_count--;
+    return text;
+}
+
+// Presses the key at the cursor along with the keys of the following characters that can go down
+// in the same report, and moves the cursor past them. The previously held keys are released in
+// the same report, so keys of held characters can't be packed.
+static void press_keys(uint32_t key) {
+    uint32_t mods = SELECT_MODS(key);
+    uint32_t keys[STRING_SENDER_KEYS_MAX];
+    int count = 0;
+
+    do {
+        keys[count++] = key;
+        key = ascii_key(*++cursor);
+    } while (count < STRING_SENDER_KEYS_MAX && key != 0 && SELECT_MODS(key) == mods &&
+             ZMK_HID_USAGE_ID(key) > ZMK_HID_USAGE_ID(keys[count - 1]) && !is_held(key));
+
+    string_sender_release();
+    for (int i = 0; i < count; i++) {
+        string_sender_press(keys[i]);
+    }
+    zmk_hid_keyboard_press_mask(&held_mask);
+}
+
+// Sends reports for as long as the endpoint can take them. Each report releases the keys of the
+// previous one, so a separate release report is only needed when a character repeats a held key or
+// changes the modifiers.
+static void string_sender_run(void) {
+    while (true) {
+        uint32_t key = 0;
+        while (key == 0 && (cursor != NULL || (cursor = next_text()) != NULL)) {
+            key = next_key();
+            if (key == 0) {
+                cursor = NULL;
+            }
+        }
+
+        if (key == 0 && held_count == 0) {
+            return;
+        }
+
+        if (!zmk_endpoints_keyboard_report_ready()) {
+            zmk_timer_start(&retry_timer, k_uptime_get() + STRING_SENDER_RETRY_MS);
+            return;
+        }
+
+        if (held_count != 0 &&
+            (key == 0 || is_held(key) || SELECT_MODS(key) != SELECT_MODS(held_keys[0]))) {
+            string_sender_release();
+        } else {
+            press_keys(key);
+        }
+
+        LOG_DBG("sending report with %d keys pressed", held_count);
+        zmk_endpoints_send_report(HID_USAGE_KEY);
+    }
+}
+
+static void string_sender_timer_handler(struct zmk_timer *timer) { string_sender_run(); }
+
+int zmk_string_sender_send(const char *text) {
+    if (pending_count == CONFIG_ZMK_STRING_SENDER_QUEUE_SIZE) {
+        LOG_ERR("Unable to send string, more than %d queued", CONFIG_ZMK_STRING_SENDER_QUEUE_SIZE);
+        return -ENOMEM;
+    }
+
+    pending[(pending_head + pending_count) % CONFIG_ZMK_STRING_SENDER_QUEUE_SIZE] = text;
+    pending_count++;
+
+    // While the endpoint is busy, the retry timer picks up the new text once the current one is
+    // done.
+    if (!zmk_timer_is_pending(&retry_timer)) {
+        string_sender_run();
+    }
+
+    return 0;
+}
+
+static int string_sender_init(const struct device *_arg) {
+    zmk_timer_init(&retry_timer, string_sender_timer_handler);
+    return 0;
+}
+
+SYS_INIT(string_sender_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
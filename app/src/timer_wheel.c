@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/timer_wheel.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define WHEEL_SLOTS CONFIG_ZMK_TIMER_WHEEL_SLOTS
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+BUILD_ASSERT((WHEEL_SLOTS & WHEEL_MASK) == 0, "CONFIG_ZMK_TIMER_WHEEL_SLOTS must be a power of 2");
+
+// One slot per millisecond tick of the next rotation, so each slot only holds timers due at a
+// single tick.
+static sys_dlist_t wheel[WHEEL_SLOTS];
+
+// Timers due after the next rotation, sorted by deadline, then in the order they were started.
+// They move onto the wheel once their tick comes within a rotation.
+static sys_dlist_t overflow;
+
+// Timers started with a deadline whose tick has already been dispatched, in the order they were
+// started.
+static sys_dlist_t expired;
+
+static uint32_t pending_count;
+
+// Every tick up to and including this one has been dispatched. The wheel holds the ticks after it,
+// up to a rotation ahead.
+static int64_t processed_until;
+
+// Tick the kernel timeout is currently armed for, or INT64_MAX when it isn't.
+static int64_t armed_at = INT64_MAX;
+
+static bool dispatching;
+
+static void wheel_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(wheel_work, wheel_work_handler);
+
+static void wheel_arm(int64_t tick) {
+    armed_at = tick;
+    k_work_reschedule(&wheel_work, K_MSEC(MAX(tick - k_uptime_get(), 0)));
+}
+
+static void wheel_disarm() {
+    armed_at = INT64_MAX;
+    k_work_cancel_delayable(&wheel_work);
+}
+
+static void wheel_unlink(struct zmk_timer *timer) {
+    sys_dlist_remove(&timer->node);
+    pending_count--;
+}
+
+static void overflow_insert(struct zmk_timer *timer) {
+    struct zmk_timer *next;
+    SYS_DLIST_FOR_EACH_CONTAINER(&overflow, next, node) {
+        if (next->tick > timer->tick) {
+            sys_dlist_insert(&next->node, &timer->node);
+            return;
+        }
+    }
+    sys_dlist_append(&overflow, &timer->node);
+}
+
+// Moves the overflow timers that came within a rotation onto the wheel. This happens as soon as the
+// wheel moves on, before any timer can be started for the same tick, so their order is kept.
+static void wheel_cascade() {
+    sys_dnode_t *node;
+    while ((node = sys_dlist_peek_head(&overflow)) != NULL) {
+        struct zmk_timer *timer = CONTAINER_OF(node, struct zmk_timer, node);
+        if (timer->tick > processed_until + WHEEL_SLOTS) {
+            break;
+        }
+        sys_dlist_remove(node);
+        sys_dlist_append(&wheel[timer->tick & WHEEL_MASK], node);
+    }
+}
+
+// Finds the earliest tick with a timer due, or INT64_MAX if there is none. Empty slots only cost a
+// check of their list head.
+static int64_t wheel_next_tick() {
+    for (int64_t tick = processed_until + 1; tick <= processed_until + WHEEL_SLOTS; tick++) {
+        if (!sys_dlist_is_empty(&wheel[tick & WHEEL_MASK])) {
+            return tick;
+        }
+    }
+
+    sys_dnode_t *node = sys_dlist_peek_head(&overflow);
+    return node != NULL ? CONTAINER_OF(node, struct zmk_timer, node)->tick : INT64_MAX;
+}
+
+static void wheel_advance(int64_t tick) {
+    processed_until = MAX(processed_until, tick);
+    wheel_cascade();
+}
+
+static void wheel_rearm() {
+    if (pending_count == 0) {
+        wheel_disarm();
+    } else if (!sys_dlist_is_empty(&expired)) {
+        wheel_arm(processed_until);
+    } else {
+        wheel_arm(wheel_next_tick());
+    }
+}
+
+static void wheel_run_expired() {
+    sys_dnode_t *node;
+    while ((node = sys_dlist_peek_head(&expired)) != NULL) {
+        struct zmk_timer *timer = CONTAINER_OF(node, struct zmk_timer, node);
+        wheel_unlink(timer);
+        timer->handler(timer);
+    }
+}
+
+static void wheel_work_handler(struct k_work *work) {
+    int64_t now = k_uptime_get();
+
+    armed_at = INT64_MAX;
+    dispatching = true;
+
+    wheel_run_expired();
+
+    // Jumps from one tick with timers due to the next, skipping the empty ones in between.
+    int64_t tick;
+    while (pending_count > 0 && (tick = wheel_next_tick()) <= now) {
+        wheel_advance(tick - 1);
+
+        // Handlers may start or stop other timers, so look up the next due timer afresh each time.
+        // Timers started for this tick from within a handler are appended and run in this pass.
+        sys_dnode_t *node;
+        while ((node = sys_dlist_peek_head(&wheel[tick & WHEEL_MASK])) != NULL) {
+            struct zmk_timer *timer = CONTAINER_OF(node, struct zmk_timer, node);
+            wheel_unlink(timer);
+            timer->handler(timer);
+        }
+
+        wheel_advance(tick);
+        wheel_run_expired();
+    }
+
+    // Every timer left is due after now, so the wheel can move on to the present.
+    wheel_advance(now);
+
+    dispatching = false;
+    wheel_rearm();
+}
+
+void zmk_timer_init(struct zmk_timer *timer, zmk_timer_handler_t handler) {
+    sys_dnode_init(&timer->node);
+    timer->handler = handler;
+    timer->deadline = 0;
+    timer->tick = 0;
+}
+
+void zmk_timer_start(struct zmk_timer *timer, int64_t deadline) {
+    if (zmk_timer_is_pending(timer)) {
+        wheel_unlink(timer);
+    }
+
+    if (pending_count == 0 && !dispatching) {
+        // Nothing is filed on the wheel, so it can skip straight to the present. While dispatching,
+        // the tick being run has to stay ahead of processed_until.
+        processed_until = MAX(processed_until, k_uptime_get() - 1);
+    }
+
+    timer->deadline = deadline;
+    if (deadline <= processed_until) {
+        timer->tick = processed_until;
+        sys_dlist_append(&expired, &timer->node);
+    } else if (deadline <= processed_until + WHEEL_SLOTS) {
+        timer->tick = deadline;
+        sys_dlist_append(&wheel[timer->tick & WHEEL_MASK], &timer->node);
+    } else {
+        timer->tick = deadline;
+        overflow_insert(timer);
+    }
+    pending_count++;
+
+    if (!dispatching && timer->tick < armed_at) {
+        wheel_arm(timer->tick);
+    }
+}
+
+void zmk_timer_stop(struct zmk_timer *timer) {
+    if (!zmk_timer_is_pending(timer)) {
+        return;
+    }
+
+    wheel_unlink(timer);
+
+    // If this was the earliest timer, the kernel timeout is left armed and simply finds nothing to
+    // run, which is cheaper than rescanning the wheel here.
+    if (!dispatching && pending_count == 0) {
+        wheel_disarm();
+    }
+}
+
+static int timer_wheel_init(const struct device *_arg) {
+    for (int i = 0; i < WHEEL_SLOTS; i++) {
+        sys_dlist_init(&wheel[i]);
+    }
+    sys_dlist_init(&overflow);
+    sys_dlist_init(&expired);
+    return 0;
+}
+
+SYS_INIT(timer_wheel_init, POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
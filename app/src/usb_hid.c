@@ -6,28 +6,341 @@
 
 #include <zephyr/device.h>
 #include <zephyr/init.h>
+#include <zephyr/spinlock.h>
+
+#include <string.h>
 
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/class/usb_hid.h>
 
 #include <zmk/usb.h>
 #include <zmk/hid.h>
+#include <zmk/hog_report_queue.h>
 #include <zmk/keymap.h>
 #include <zmk/event_manager.h>
+#include <zmk/events/usb_conn_state_changed.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+union usb_hid_report {
+    struct zmk_hid_keyboard_report keyboard;
+    struct zmk_hid_boot_report boot;
+    struct zmk_hid_consumer_report consumer;
+#if IS_ENABLED(CONFIG_ZMK_MOUSE)
+    struct zmk_hid_mouse_report mouse;
+#endif
+};
+
+struct queued_report {
+    // Boot protocol reports don't start with their report ID, so it is kept separately.
+    uint8_t report_id;
+    uint8_t len;
+    uint8_t data[sizeof(union usb_hid_report)];
+};
+
+#if IS_ENABLED(CONFIG_ZMK_MOUSE)
+#define USB_HID_REPORT_TYPES 3
+#else
+#define USB_HID_REPORT_TYPES 2
+#endif
+
+// Each interface has its own interrupt IN endpoint and its own queue of reports waiting for the
+// previous IN transfer to complete. Sending never blocks: a report is written right away if the
+// endpoint is idle, and otherwise queued for in_ready_cb to write once the host has polled the
+// previous one, so reports go out as fast as the host polls.
+struct usb_hid_interface {
+    const char *name;
+    const uint8_t *report_desc;
+    size_t report_desc_len;
+    const struct device *dev;
+    struct queued_report queue[CONFIG_ZMK_USB_HID_REPORT_QUEUE_SIZE];
+    uint8_t queue_head;
+    uint8_t queue_count;
+    bool in_flight;
+    // Last report of each type written to the endpoint, which queued reports are compared against
+    // when the queue is full.
+    struct queued_report written[USB_HID_REPORT_TYPES];
+#if IS_ENABLED(CONFIG_ZMK_USB_BOOT)
+    uint8_t protocol;
+#endif
+};
+
+#define USB_HID_INTERFACE(_name, _desc)                                                            \
+    { .name = _name, .report_desc = _desc, .report_desc_len = sizeof(_desc) }
+
+#if IS_ENABLED(CONFIG_ZMK_USB_HID_SEPARATE_INTERFACES)
+
+// Separate interfaces keep a burst of reports of one type, such as mouse movement, from delaying
+// the others.
+static const uint8_t keyboard_report_desc[] = {ZMK_HID_KEYBOARD_REPORT_DESC};
+static const uint8_t consumer_report_desc[] = {ZMK_HID_CONSUMER_REPORT_DESC};
+#if IS_ENABLED(CONFIG_ZMK_MOUSE)
+static const uint8_t mouse_report_desc[] = {ZMK_HID_MOUSE_REPORT_DESC};
+#endif
+
+static struct usb_hid_interface interfaces[] = {
+    USB_HID_INTERFACE("HID_0", keyboard_report_desc),
+    USB_HID_INTERFACE("HID_1", consumer_report_desc),
+#if IS_ENABLED(CONFIG_ZMK_MOUSE)
+    USB_HID_INTERFACE("HID_2", mouse_report_desc),
+#endif
+};
+
+static struct usb_hid_interface *get_interface(uint8_t report_id) {
+    switch (report_id) {
+    case ZMK_HID_REPORT_ID_KEYBOARD:
+        return &interfaces[0];
+    case ZMK_HID_REPORT_ID_CONSUMER:
+        return &interfaces[1];
+#if IS_ENABLED(CONFIG_ZMK_MOUSE)
+    case ZMK_HID_REPORT_ID_MOUSE:
+        return &interfaces[2];
+#endif
+    default:
+        return NULL;
+    }
+}
+
+#else
+
+static struct usb_hid_interface interfaces[] = {
+    USB_HID_INTERFACE("HID_0", zmk_hid_report_desc),
+};
 
-static const struct device *hid_dev;
+static struct usb_hid_interface *get_interface(uint8_t report_id) { return &interfaces[0]; }
 
-static K_SEM_DEFINE(hid_sem, 1, 1);
+#endif /* IS_ENABLED(CONFIG_ZMK_USB_HID_SEPARATE_INTERFACES) */
 
-static void in_ready_cb(const struct device *dev) { k_sem_give(&hid_sem); }
+static struct k_spinlock lock;
+
+static void reset_queues(bool reset_protocol) {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    for (int i = 0; i < ARRAY_SIZE(interfaces); i++) {
+        interfaces[i].queue_count = 0;
+        interfaces[i].in_flight = false;
+        memset(interfaces[i].written, 0, sizeof(interfaces[i].written));
+#if IS_ENABLED(CONFIG_ZMK_USB_BOOT)
+        // Hosts have to select the boot protocol again after a reset.
+        if (reset_protocol) {
+            interfaces[i].protocol = HID_PROTOCOL_REPORT;
+        }
+#endif
+    }
+    k_spin_unlock(&lock, key);
+}
+
+static struct queued_report *queue_at(struct usb_hid_interface *iface, int index) {
+    return &iface->queue[(iface->queue_head + index) % CONFIG_ZMK_USB_HID_REPORT_QUEUE_SIZE];
+}
+
+static struct queued_report *written_report(struct usb_hid_interface *iface, uint8_t report_id) {
+    for (int i = 0; i < ARRAY_SIZE(iface->written); i++) {
+        if (iface->written[i].report_id == report_id || iface->written[i].report_id == 0) {
+            iface->written[i].report_id = report_id;
+            return &iface->written[i];
+        }
+    }
+    return NULL;
+}
+
+static void record_written_report(struct usb_hid_interface *iface, uint8_t report_id,
+                                  const uint8_t *report, size_t len) {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    struct queued_report *written = written_report(iface, report_id);
+    if (written != NULL) {
+        written->len = len;
+        memcpy(written->data, report, len);
+    }
+    k_spin_unlock(&lock, key);
+}
+
+static struct usb_hid_interface *find_interface(const struct device *dev) {
+    for (int i = 0; i < ARRAY_SIZE(interfaces); i++) {
+        if (interfaces[i].dev == dev) {
+            return &interfaces[i];
+        }
+    }
+    return NULL;
+}
+
+// Writes the oldest queued report, skipping reports that fail to write, and marks the endpoint idle
+// once the queue is empty. This may run in interrupt context, so writes happen outside the lock
+// with a copy of the queued report.
+static void write_queued_report(struct usb_hid_interface *iface) {
+    struct queued_report next;
+
+    while (true) {
+        k_spinlock_key_t key = k_spin_lock(&lock);
+        if (iface->queue_count == 0) {
+            iface->in_flight = false;
+            k_spin_unlock(&lock, key);
+            return;
+        }
+        next = *queue_at(iface, 0);
+        iface->queue_head = (iface->queue_head + 1) % CONFIG_ZMK_USB_HID_REPORT_QUEUE_SIZE;
+        iface->queue_count--;
+        k_spin_unlock(&lock, key);
+
+        int err = hid_int_ep_write(iface->dev, next.data, next.len, NULL);
+        if (!err) {
+            record_written_report(iface, next.report_id, next.data, next.len);
+            return;
+        }
+        LOG_ERR("Failed to write queued report on %s (%d)", iface->name, err);
+    }
+}
+
+static void in_ready_cb(const struct device *dev) {
+    struct usb_hid_interface *iface = find_interface(dev);
+    if (iface != NULL) {
+        write_queued_report(iface);
+    }
+}
+
+#if IS_ENABLED(CONFIG_ZMK_USB_BOOT)
+static void protocol_cb(const struct device *dev, uint8_t protocol) {
+    struct usb_hid_interface *iface = find_interface(dev);
+    if (iface == NULL) {
+        return;
+    }
+
+    LOG_DBG("%s switched to %s protocol", iface->name,
+            protocol == HID_PROTOCOL_BOOT ? "boot" : "report");
+
+    // Reports queued in the previous protocol's format would confuse the host.
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    iface->protocol = protocol;
+    iface->queue_count = 0;
+    memset(iface->written, 0, sizeof(iface->written));
+    k_spin_unlock(&lock, key);
+}
+#endif /* IS_ENABLED(CONFIG_ZMK_USB_BOOT) */
 
 static const struct hid_ops ops = {
     .int_in_ready = in_ready_cb,
+#if IS_ENABLED(CONFIG_ZMK_USB_BOOT)
+    .protocol_change = protocol_cb,
+#endif
 };
 
+static struct zmk_hog_report_layout report_layout(const struct usb_hid_interface *iface,
+                                                  uint8_t report_id, size_t len) {
+    struct zmk_hog_report_layout layout = {.size = len, .array_offset = len};
+
+#if IS_ENABLED(CONFIG_ZMK_USB_BOOT)
+    if (iface->protocol == HID_PROTOCOL_BOOT) {
+        layout.array_offset = offsetof(struct zmk_hid_boot_report, keys);
+        layout.array_elem_size = sizeof(((struct zmk_hid_boot_report *)0)->keys[0]);
+        return layout;
+    }
+#endif
+
+    switch (report_id) {
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+    case ZMK_HID_REPORT_ID_KEYBOARD:
+        layout.array_offset = offsetof(struct zmk_hid_keyboard_report, body.keys);
+        layout.array_elem_size = sizeof(((struct zmk_hid_keyboard_report *)0)->body.keys[0]);
+        break;
+#endif
+    case ZMK_HID_REPORT_ID_CONSUMER:
+        layout.array_offset = offsetof(struct zmk_hid_consumer_report, body.keys);
+        layout.array_elem_size = sizeof(((struct zmk_hid_consumer_report *)0)->body.keys[0]);
+        break;
+    }
+
+    return layout;
+}
+
+// Picks the queued report to leave out when the queue is full, using the same rules as the HOG
+// report queues: the newest report with the same ID that can be merged with the one after it, so
+// the host still sees every transition. If none can, the newest report with the same ID is
+// dropped, which at least leaves the host with the right state in the end.
+static int find_report_to_merge(struct usb_hid_interface *iface, uint8_t report_id,
+                                const uint8_t *report, size_t len) {
+    struct zmk_hog_report_layout layout = report_layout(iface, report_id, len);
+    const uint8_t *next = report;
+    int newest = -ENOMEM;
+
+    for (int i = iface->queue_count - 1; i >= 0; i--) {
+        const struct queued_report *queued = queue_at(iface, i);
+        if (queued->report_id != report_id) {
+            continue;
+        }
+        if (newest < 0) {
+            newest = i;
+        }
+
+        const uint8_t *prev = NULL;
+        for (int j = i - 1; j >= 0 && prev == NULL; j--) {
+            if (queue_at(iface, j)->report_id == report_id) {
+                prev = queue_at(iface, j)->data;
+            }
+        }
+        if (prev == NULL) {
+            const struct queued_report *written = written_report(iface, report_id);
+            if (written == NULL) {
+                return newest;
+            }
+            prev = written->data;
+        }
+
+        if (zmk_hog_report_can_merge(&layout, prev, queued->data, next)) {
+            return i;
+        }
+        next = queued->data;
+    }
+
+    if (newest >= 0) {
+        LOG_WRN("USB report queue of %s full, dropping a queued report %d", iface->name,
+                report_id);
+    }
+    return newest;
+}
+
+// Queues a report while a transfer is in flight. When the queue is full, a queued report with the
+// same ID is merged away to make room.
+static int queue_report(struct usb_hid_interface *iface, uint8_t report_id, const uint8_t *report,
+                        size_t len) {
+    if (iface->queue_count == CONFIG_ZMK_USB_HID_REPORT_QUEUE_SIZE) {
+        int index = find_report_to_merge(iface, report_id, report, len);
+        if (index < 0) {
+            return index;
+        }
+
+        for (int i = index; i < iface->queue_count - 1; i++) {
+            *queue_at(iface, i) = *queue_at(iface, i + 1);
+        }
+        iface->queue_count--;
+    }
+
+    struct queued_report *slot = queue_at(iface, iface->queue_count++);
+    slot->report_id = report_id;
+    slot->len = len;
+    memcpy(slot->data, report, len);
+    return 0;
+}
+
 int zmk_usb_hid_send_report(const uint8_t *report, size_t len) {
+    uint8_t report_id = report[0];
+    struct usb_hid_interface *iface = get_interface(report_id);
+    if (iface == NULL || iface->dev == NULL || len > sizeof(union usb_hid_report)) {
+        return -EINVAL;
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_USB_BOOT)
+    struct zmk_hid_boot_report boot_report;
+
+    // Hosts using the boot protocol only understand boot keyboard reports on the boot interface.
+    if (iface->protocol == HID_PROTOCOL_BOOT) {
+        if (report_id != ZMK_HID_REPORT_ID_KEYBOARD) {
+            return 0;
+        }
+        zmk_hid_keyboard_report_to_boot((const struct zmk_hid_keyboard_report *)report,
+                                        &boot_report);
+        report = (const uint8_t *)&boot_report;
+        len = sizeof(boot_report);
+    }
+#endif
+
     switch (zmk_usb_get_status()) {
     case USB_DC_SUSPEND:
         return usb_wakeup_request();
@@ -35,28 +348,97 @@ int zmk_usb_hid_send_report(const uint8_t *report, size_t len) {
     case USB_DC_RESET:
     case USB_DC_DISCONNECTED:
     case USB_DC_UNKNOWN:
+        // Nothing queued will be polled anymore.
+        reset_queues(true);
         return -ENODEV;
-    default:
-        k_sem_take(&hid_sem, K_MSEC(30));
-        int err = hid_int_ep_write(hid_dev, report, len, NULL);
+    default: {
+        k_spinlock_key_t key = k_spin_lock(&lock);
+        if (iface->in_flight) {
+            int err = queue_report(iface, report_id, report, len);
+            k_spin_unlock(&lock, key);
+            if (err) {
+                LOG_WRN("USB report queue of %s full, dropping report %d", iface->name, report_id);
+            }
+            return err;
+        }
+        iface->in_flight = true;
+        k_spin_unlock(&lock, key);
 
+        int err = hid_int_ep_write(iface->dev, report, len, NULL);
         if (err) {
-            k_sem_give(&hid_sem);
+            // Reports queued behind this one in the meantime would otherwise wait for an IN
+            // transfer that never happens.
+            write_queued_report(iface);
+        } else {
+            record_written_report(iface, report_id, report, len);
         }
 
         return err;
     }
+    }
 }
 
-static int zmk_usb_hid_init(const struct device *_arg) {
-    hid_dev = device_get_binding("HID_0");
-    if (hid_dev == NULL) {
-        LOG_ERR("Unable to locate HID device");
-        return -EINVAL;
+bool zmk_usb_hid_is_ready(uint8_t report_id) {
+    switch (zmk_usb_get_status()) {
+    case USB_DC_SUSPEND:
+    case USB_DC_ERROR:
+    case USB_DC_RESET:
+    case USB_DC_DISCONNECTED:
+    case USB_DC_UNKNOWN:
+        // Sending returns right away, waking up the host if it is suspended.
+        return true;
+    default: {
+        struct usb_hid_interface *iface = get_interface(report_id);
+        return iface == NULL || !iface->in_flight;
     }
+    }
+}
 
-    usb_hid_register_device(hid_dev, zmk_hid_report_desc, sizeof(zmk_hid_report_desc), &ops);
-    usb_hid_init(hid_dev);
+// A reset, disconnect or new configuration aborts the transfer in flight without calling
+// in_ready_cb, so the queues start over, or the interface would wait for it forever.
+static int usb_hid_listener(const zmk_event_t *eh) {
+    switch (zmk_usb_get_status()) {
+    case USB_DC_RESET:
+    case USB_DC_DISCONNECTED:
+    case USB_DC_ERROR:
+    case USB_DC_UNKNOWN:
+        reset_queues(true);
+        break;
+    case USB_DC_CONFIGURED:
+        // The host may already have selected a protocol for the new configuration.
+        reset_queues(false);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+ZMK_LISTENER(usb_hid, usb_hid_listener);
+ZMK_SUBSCRIPTION(usb_hid, zmk_usb_conn_state_changed);
+
+static int zmk_usb_hid_init(const struct device *_arg) {
+    for (int i = 0; i < ARRAY_SIZE(interfaces); i++) {
+        struct usb_hid_interface *iface = &interfaces[i];
+
+        iface->dev = device_get_binding(iface->name);
+        if (iface->dev == NULL) {
+            LOG_ERR("Unable to locate HID device %s", iface->name);
+            return -EINVAL;
+        }
+
+        usb_hid_register_device(iface->dev, iface->report_desc, iface->report_desc_len, &ops);
+
+#if IS_ENABLED(CONFIG_ZMK_USB_BOOT)
+        iface->protocol = HID_PROTOCOL_REPORT;
+        // Advertising the boot keyboard subclass lets BIOS/UEFI hosts select the boot protocol.
+        if (iface == get_interface(ZMK_HID_REPORT_ID_KEYBOARD)) {
+            usb_hid_set_proto_code(iface->dev, HID_BOOT_IFACE_CODE_KEYBOARD);
+        }
+#endif
+
+        usb_hid_init(iface->dev);
+    }
 
     return 0;
 }
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_combos
+
+#include <zephyr/ztest.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/combo_engine.h>
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// Each chord is looked up this many times when measuring, so the per-lookup figure is stable.
+#define BENCHMARK_ROUNDS 10
+
+#define CHORD_POSITIONS(n) static const int32_t chord_positions_##n[] = DT_PROP(n, key_positions);
+
+DT_INST_FOREACH_CHILD(0, CHORD_POSITIONS)
+
+#define CHORD_INST(n)                                                                              \
+    {                                                                                              \
+        .timeout_ms = DT_PROP(n, timeout_ms),                                                      \
+        .require_prior_idle_ms = DT_PROP(n, require_prior_idle_ms),                                \
+        .key_positions = chord_positions_##n,                                                      \
+        .key_position_len = DT_PROP_LEN(n, key_positions),                                         \
+        .layer_mask = ~(zmk_keymap_layers_state_t)0,                                               \
+    },
+
+static const struct combo_cfg chords[] = {DT_INST_FOREACH_CHILD(0, CHORD_INST)};
+static struct zmk_combo_position_mask chord_masks[ARRAY_SIZE(chords)];
+
+bool zmk_combo_is_quick_tap(const struct combo_cfg *combo, int64_t timestamp) { return false; }
+
+// Presses the keys of the chord in order and returns the combo the captured keys complete.
+static const struct combo_cfg *press_chord(const struct combo_cfg *chord) {
+    struct zmk_combo_position_mask pressed = {0};
+    zmk_combo_candidates_clear();
+    zmk_combo_candidates_setup(chord->key_positions[0], 0);
+    zmk_combo_position_mask_set(&pressed, chord->key_positions[0]);
+    for (int i = 1; i < chord->key_position_len; i++) {
+        zmk_combo_candidates_filter(chord->key_positions[i]);
+        zmk_combo_position_mask_set(&pressed, chord->key_positions[i]);
+    }
+    return zmk_combo_candidates_completely_pressed(&pressed, chord->key_position_len);
+}
+
+static void *combo_chord_table_setup(void) {
+    for (int i = 0; i < ARRAY_SIZE(chords); i++) {
+        for (int j = 0; j < chords[i].key_position_len; j++) {
+            zmk_combo_position_mask_set(&chord_masks[i], chords[i].key_positions[j]);
+        }
+    }
+    zassert_ok(zmk_combo_candidates_init(chords, ARRAY_SIZE(chords)), "init failed");
+    zmk_combo_candidates_set_layer(0);
+    return NULL;
+}
+
+ZTEST(combo_chord_table, test_every_chord_is_found) {
+    for (int i = 0; i < ARRAY_SIZE(chords); i++) {
+        const struct combo_cfg *found = press_chord(&chords[i]);
+        zassert_not_null(found, "chord %d not found", i);
+
+        // the dictionary may hold the same chord twice; either entry is a match.
+        zassert_true(zmk_combo_position_mask_equals(&chord_masks[found - chords], &chord_masks[i]),
+                     "chord %d mismatched", i);
+    }
+}
+
+ZTEST(combo_chord_table, test_partial_chord_is_not_completed) {
+    for (int i = 0; i < ARRAY_SIZE(chords); i++) {
+        const struct combo_cfg *chord = &chords[i];
+        struct zmk_combo_position_mask pressed = {0};
+        zmk_combo_candidates_clear();
+        zmk_combo_candidates_setup(chord->key_positions[0], 0);
+        zmk_combo_position_mask_set(&pressed, chord->key_positions[0]);
+
+        // a single key is never a chord, so nothing may complete on the first press.
+        zassert_is_null(zmk_combo_candidates_completely_pressed(&pressed, 1),
+                        "chord %d completed by one key", i);
+    }
+}
+
+ZTEST(combo_chord_table, test_candidates_time_out_by_group) {
+    for (int32_t position = 0; position < ZMK_KEYMAP_LEN; position++) {
+        int expected_count = 0, expected_remaining = 0;
+        int32_t first_timeout_ms = INT32_MAX;
+        for (int j = 0; j < ARRAY_SIZE(chords); j++) {
+            if (zmk_combo_position_mask_test(&chord_masks[j], position)) {
+                expected_count++;
+                first_timeout_ms = MIN(first_timeout_ms, chords[j].timeout_ms);
+            }
+        }
+        for (int j = 0; j < ARRAY_SIZE(chords); j++) {
+            if (zmk_combo_position_mask_test(&chord_masks[j], position) &&
+                chords[j].timeout_ms > first_timeout_ms) {
+                expected_remaining++;
+            }
+        }
+
+        zmk_combo_candidates_clear();
+        int count = zmk_combo_candidates_setup(position, 0);
+        zassert_equal(count, expected_count, "position %d has %d candidates", position, count);
+        if (count == 0) {
+            continue;
+        }
+        zassert_equal(zmk_combo_candidates_first_timeout(), first_timeout_ms,
+                      "position %d times out at %lld", position,
+                      zmk_combo_candidates_first_timeout());
+
+        int remaining = zmk_combo_candidates_filter_timed_out(first_timeout_ms);
+        zassert_equal(remaining, expected_remaining, "position %d kept %d candidates", position,
+                      remaining);
+    }
+}
+
+ZTEST(combo_chord_table, test_benchmark_chord_lookup) {
+    uint32_t start = k_cycle_get_32();
+    for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+        for (int i = 0; i < ARRAY_SIZE(chords); i++) {
+            press_chord(&chords[i]);
+        }
+    }
+    uint32_t cycles = k_cycle_get_32() - start;
+
+    TC_PRINT("%d chords: %u cycles per chord, including setup and filtering\n",
+             (int)ARRAY_SIZE(chords), cycles / (uint32_t)(BENCHMARK_ROUNDS * ARRAY_SIZE(chords)));
+}
+
+ZTEST_SUITE(combo_chord_table, NULL, combo_chord_table_setup, NULL, NULL, NULL);
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/ztest.h>
+#include <zephyr/logging/log.h>
+
+#include <zmk/hog_report_queue.h>
+
+LOG_MODULE_REGISTER(zmk, LOG_LEVEL_DBG);
+
+// Mirrors an HKRO keyboard report body with six key slots.
+struct hkro_report {
+    uint8_t modifiers;
+    uint8_t _reserved;
+    uint8_t keys[6];
+} __packed;
+
+// Mirrors a consumer report body with full 16 bit usages.
+struct consumer_report {
+    uint16_t keys[6];
+} __packed;
+
+#define KEY_A 0x04
+#define KEY_B 0x05
+#define KEY_C 0x06
+#define MUTE 0xE2
+#define VOLUME_DOWN 0xEA
+
+static void put_hkro(struct zmk_hog_report_queue *queue, uint8_t key0, uint8_t key1,
+                     uint8_t key2) {
+    struct hkro_report report = {.keys = {key0, key1, key2}};
+    zmk_hog_report_queue_put(queue, &report);
+}
+
+static void expect_hkro(struct zmk_hog_report_queue *queue, uint8_t key0, uint8_t key1,
+                        uint8_t key2) {
+    struct hkro_report report;
+    struct hkro_report expected = {.keys = {key0, key1, key2}};
+    zassert_true(zmk_hog_report_queue_get(queue, &report), "queue is empty");
+    zassert_mem_equal(&report, &expected, sizeof(report), "unexpected report");
+}
+
+static void put_consumer(struct zmk_hog_report_queue *queue, uint16_t key0, uint16_t key1) {
+    struct consumer_report report = {.keys = {key0, key1}};
+    zmk_hog_report_queue_put(queue, &report);
+}
+
+static void expect_consumer(struct zmk_hog_report_queue *queue, uint16_t key0, uint16_t key1) {
+    struct consumer_report report;
+    struct consumer_report expected = {.keys = {key0, key1}};
+    zassert_true(zmk_hog_report_queue_get(queue, &report), "queue is empty");
+    zassert_mem_equal(&report, &expected, sizeof(report), "unexpected report");
+}
+
+static void expect_empty(struct zmk_hog_report_queue *queue, void *report) {
+    zassert_false(zmk_hog_report_queue_get(queue, report), "queue is not empty");
+}
+
+static void expect_stats(struct zmk_hog_report_queue *queue, uint32_t merged, uint32_t dropped) {
+    struct zmk_hog_queue_stats stats;
+    zmk_hog_report_queue_get_stats(queue, &stats);
+    zassert_equal(stats.merged, merged, "merged %u reports", stats.merged);
+    zassert_equal(stats.dropped, dropped, "dropped %u reports", stats.dropped);
+}
+
+ZTEST(hog_report_queue, test_hkro_tap_replaced_in_same_slot_is_kept) {
+    ZMK_HOG_REPORT_QUEUE_DEFINE(queue, struct hkro_report, 2, offsetof(struct hkro_report, keys),
+                                1);
+
+    // B takes the slot A was released from, which hides the A tap if slots are compared bitwise.
+    put_hkro(&queue, KEY_A, 0, 0);
+    put_hkro(&queue, KEY_B, 0, 0);
+    put_hkro(&queue, 0, 0, 0);
+
+    expect_hkro(&queue, KEY_A, 0, 0);
+    expect_hkro(&queue, 0, 0, 0);
+    expect_empty(&queue, &(struct hkro_report){0});
+    expect_stats(&queue, 0, 1);
+}
+
+ZTEST(hog_report_queue, test_hkro_press_kept_in_another_slot_merges) {
+    ZMK_HOG_REPORT_QUEUE_DEFINE(queue, struct hkro_report, 2, offsetof(struct hkro_report, keys),
+                                1);
+
+    put_hkro(&queue, KEY_A, 0, 0);
+    put_hkro(&queue, KEY_A, KEY_B, 0);
+    // B moves to the first slot, but stays pressed, so the previous report can be merged away.
+    put_hkro(&queue, KEY_B, KEY_C, 0);
+
+    expect_hkro(&queue, KEY_A, 0, 0);
+    expect_hkro(&queue, KEY_B, KEY_C, 0);
+    expect_empty(&queue, &(struct hkro_report){0});
+    expect_stats(&queue, 1, 0);
+}
+
+ZTEST(hog_report_queue, test_hkro_released_key_pressed_again_is_kept) {
+    ZMK_HOG_REPORT_QUEUE_DEFINE(queue, struct hkro_report, 2, offsetof(struct hkro_report, keys),
+                                1);
+
+    put_hkro(&queue, KEY_A, KEY_B, 0);
+    put_hkro(&queue, KEY_A, 0, 0);
+    put_hkro(&queue, KEY_B, KEY_A, 0);
+
+    expect_hkro(&queue, KEY_A, KEY_B, 0);
+    expect_hkro(&queue, KEY_B, KEY_A, 0);
+    expect_empty(&queue, &(struct hkro_report){0});
+    expect_stats(&queue, 0, 1);
+}
+
+ZTEST(hog_report_queue, test_consumer_tap_replaced_in_same_slot_is_kept) {
+    ZMK_HOG_REPORT_QUEUE_DEFINE(queue, struct consumer_report, 2, 0, sizeof(uint16_t));
+
+    // The usages share most of their bits, which hides the mute tap if compared bitwise.
+    put_consumer(&queue, MUTE, 0);
+    put_consumer(&queue, VOLUME_DOWN, 0);
+    put_consumer(&queue, 0, 0);
+
+    expect_consumer(&queue, MUTE, 0);
+    expect_consumer(&queue, 0, 0);
+    expect_empty(&queue, &(struct consumer_report){0});
+    expect_stats(&queue, 0, 1);
+}
+
+ZTEST(hog_report_queue, test_consumer_press_kept_in_another_slot_merges) {
+    ZMK_HOG_REPORT_QUEUE_DEFINE(queue, struct consumer_report, 2, 0, sizeof(uint16_t));
+
+    put_consumer(&queue, MUTE, 0);
+    put_consumer(&queue, MUTE, VOLUME_DOWN);
+    put_consumer(&queue, VOLUME_DOWN, 0);
+
+    expect_consumer(&queue, MUTE, 0);
+    expect_consumer(&queue, VOLUME_DOWN, 0);
+    expect_empty(&queue, &(struct consumer_report){0});
+    expect_stats(&queue, 1, 0);
+}
+
+ZTEST_SUITE(hog_report_queue, NULL, NULL, NULL, NULL, NULL);
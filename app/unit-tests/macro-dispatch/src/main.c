@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/ztest.h>
+#include <zephyr/logging/log.h>
+
+#include <drivers/behavior.h>
+#include <dt-bindings/zmk/keys.h>
+#include <zmk/behavior_queue.h>
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// The macro is run this many times when measuring, so the per-step figure is stable.
+#define BENCHMARK_ROUNDS 100
+
+#define SENTENCE "The quick brown fox jumps over the lazy dog. "
+
+static const char text[] = SENTENCE SENTENCE SENTENCE SENTENCE SENTENCE;
+
+// The lane the macro was last queued with. The behavior queue is not built, so the tests step the
+// lane themselves.
+static zmk_behavior_queue_next_t lane_next;
+static uint8_t lane_context[ZMK_BEHAVIOR_QUEUE_CONTEXT_SIZE] __aligned(8);
+
+int zmk_behavior_queue_add_lane(uint32_t position, zmk_behavior_queue_next_t next,
+                                const void *context, size_t context_size) {
+    lane_next = next;
+    memcpy(lane_context, context, context_size);
+    return 0;
+}
+
+static void press_macro(void) {
+    struct zmk_behavior_binding binding = {
+        .behavior_dev = DT_PROP(DT_NODELABEL(text_macro), label),
+    };
+    struct zmk_behavior_binding_event event = {.position = 0};
+
+    lane_next = NULL;
+    behavior_keymap_binding_pressed(&binding, event);
+    zassert_not_null(lane_next, "macro was not queued");
+}
+
+static char typed_char(uint32_t usage, bool shifted) {
+    switch (usage) {
+    case SPACE:
+        return ' ';
+    case DOT:
+        return '.';
+    default:
+        return (shifted ? 'A' : 'a') + ZMK_HID_USAGE_ID(usage) - HID_USAGE_KEY_KEYBOARD_A;
+    }
+}
+
+ZTEST(macro_dispatch, test_text_is_typed) {
+    char typed[sizeof(text)] = {0};
+    int typed_len = 0;
+    bool shifted = false;
+    struct zmk_behavior_queue_step step;
+
+    press_macro();
+    while (lane_next(lane_context, &step)) {
+        zassert_equal(step.wait, 0, "unexpected wait of %d ms", step.wait);
+        if (step.binding.param1 == LSHFT) {
+            shifted = step.press;
+        } else if (step.press) {
+            zassert_true(typed_len < sizeof(text) - 1, "typed too many characters");
+            typed[typed_len++] = typed_char(step.binding.param1, shifted);
+        }
+    }
+
+    zassert_false(shifted, "shift is still pressed");
+    zassert_mem_equal(typed, text, sizeof(text), "typed \"%s\"", typed);
+}
+
+ZTEST(macro_dispatch, test_benchmark_macro_steps) {
+    struct zmk_behavior_queue_step step;
+    uint32_t steps = 0;
+
+    uint32_t start = k_cycle_get_32();
+    for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+        press_macro();
+        while (lane_next(lane_context, &step)) {
+            steps++;
+        }
+    }
+    uint32_t cycles = k_cycle_get_32() - start;
+
+    TC_PRINT("%d characters: %u steps, %u cycles per step\n", (int)strlen(text),
+             steps / BENCHMARK_ROUNDS, cycles / steps);
+}
+
+ZTEST_SUITE(macro_dispatch, NULL, NULL, NULL, NULL, NULL);